@@ -1,88 +1,331 @@
 #ifndef BFCASCADE_H
 #define BFCASCADE_H
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <cstdio>
 #include <cstdint>
 #include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
 
 #include "cuckoo.h"
+#include "../vacuumpair/vacuumfilter/crc32c.h"
 
 using namespace std;
 
+/*
+file of a built cascade (BFCascade::save, BFCascade(path)): bfc_file_header, the level directory (one
+bfc_file_level per level, in lookup order), then the bit arrays of all levels back to back from
+data_offset (page aligned), each one starting at a multiple of 64 bytes. Integers are in host byte
+order, a file written with the other byte order is rejected. Lookups run on the bit arrays in place in
+a read-only mapping of the file, so a service starts without rerunning insert over R and S. Each level
+has the CRC-32C of its bits, the header one of itself and the directory, checked on load unless asked
+not to
+*/
+struct bfc_file_header {
+	char magic[8];          // "BFCASCDE"
+	uint32_t version;
+	uint32_t byte_order;    // 0x01020304 as written
+	uint32_t header_bytes;  // sizeof(bfc_file_header)
+	uint32_t num_levels;
+	uint64_t num_items;
+	uint64_t size_in_bytes;
+	uint64_t data_offset;   // of the first level's bits, from the start of the file
+	uint64_t data_bytes;
+	uint32_t header_crc;    // Crc32c of header and directory, this field taken as 0
+	uint32_t reserved;
+};
+
+// a level's BloomFilter: its geometry, hash parameters and where its bits are
+struct bfc_file_level {
+	int64_t n;        // bits
+	int32_t m;
+	int32_t shift;
+	int32_t k;        // hashes
+	int32_t a[20];    // xor'ed into the key before each hash
+	uint32_t crc;     // Crc32c of the bits
+	uint64_t offset;  // of the bits, from data_offset
+	uint64_t bytes;   // memory_consumption
+};
+
+static_assert(sizeof(bfc_file_header) == 64 && sizeof(bfc_file_level) == 120, "written as is");
+
+namespace bfc_file {
+	const char magic[8] = {'B', 'F', 'C', 'A', 'S', 'C', 'D', 'E'};
+	const uint32_t version = 2; // 2: CRCs
+	const uint32_t byte_order = 0x01020304;
+	const uint64_t page = 4096;
+	const uint64_t level_align = 64;
+
+	inline uint64_t round_up(uint64_t x, uint64_t a) { return (x + a - 1) / a * a; }
+
+	inline uint32_t header_crc(bfc_file_header h, const bfc_file_level *dir) {
+		h.header_crc = 0;
+		return cuckoofilter::Crc32cExtend(cuckoofilter::Crc32c(&h, sizeof(h)), dir, sizeof(bfc_file_level) * h.num_levels);
+	}
+}
+
 template <typename fp_type, size_t fp_len>
 class BFCascade {
 	public :
 
     vector<BloomFilter<fp_type, fp_len>> bfc;
 	uint64_t size_in_bytes = 0;
-	size_t num_items_;
-
-    ~BFCascade() {}
-
-	void insert(vector<uint64_t> ins, vector<uint64_t> lup, vector<uint64_t> fp) { // , FILE *file)
-		// max load factor of 95%
-        double max_lf = 0.95;
-        uint64_t init_size = ins.size() / max_lf;
-
-		if (ins.size() > num_items_) // prevent overwriting during recursion
-			num_items_ = ins.size();
-        
-        BloomFilter<uint16_t, 15> bloomFilter;
-        bloomFilter.init(init_size, 1);
-		/*
-		if(bfc.size() & 1) { // odd = revoked
-			cout << "bf contains REVOKED: level " << bfc.size() << endl;
-		} 
-		else { // even = unrevoked
-			cout << "bf contains UNREVOKED: level " << bfc.size() << endl;
+	size_t num_items_ = 0;
+
+	private :
+
+	void *map_ = nullptr; // the file of a mapped cascade (BFCascade(path)), the levels' bits point into it
+	size_t map_bytes_ = 0;
+
+	public :
+
+	BFCascade() {}
+
+	// the cascade saved at path, its levels' bits used in place from a read-only mapping of the file:
+	// lookups only, a mapped cascade cannot be inserted into (its copies can). populate: read the whole
+	// file in now (MAP_POPULATE) rather than on first touch. verify: check the CRCs of all levels first
+	// (on every core), else only the header's. Throws std::runtime_error for a file that is missing,
+	// corrupt or not a cascade
+	explicit BFCascade(const string &path, bool populate = false, bool verify = true) {
+		int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+			throw runtime_error("could not open cascade " + path);
+		struct stat st;
+		if (fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(bfc_file_header)) {
+			close(fd);
+			throw runtime_error("not a cascade: " + path);
 		}
-		*/
-
-	    for(uint64_t c : ins) { // int i = 0; i < int(ins.size()); i++
-	        // uint64_t c = ins.at(i);
-			// if(i == 0) {
-			// 	cout << "index " << i << ": ";
-			// 	cout << c << '\n';
-			// }
-	        bloomFilter.insert(c);
-	    }
-		bfc.push_back(bloomFilter);
-
-	    // cout << "checking fp's: " << endl;
-	    for(uint64_t l : lup) { // int j = 0; j < int(lup.size()); j++
-	        // uint64_t l = lup.at(j);
-	        if(bloomFilter.lookup(l)) {
-	            fp.push_back(l);
-				// cout << "fp: " << l << endl;
-	        }
-	    }
-		double fpratio = (double) fp.size() / lup.size();
-		size_in_bytes += bloomFilter.mem_cost();
-		// cout << "# false hits: " << fp.size() << '\n';
-		// cout << "fp: " << fpratio << '\n';
-		// fprintf(file, "level, insert, lookup, # fp's, fp, memory(bytes), bits per item\n");
-		printf("%lu, %lu, %lu, %lu, %.5f, %lu, %.5f\n", bfc.size(), ins.size(), lup.size(), fp.size(), fpratio, bloomFilter.mem_cost(), double(bloomFilter.mem_cost())/ins.size());
-		// fprintf(file, "%lu, %lu, %lu, %lu, %.5f, %lu, %.5f\n", bfc.size(), ins.size(), lup.size(), fp.size(), fpratio, bloomFilter.mem_cost(), double(bloomFilter.mem_cost())/ins.size());
-		// cout << "# fp's " << fp.size() << " fp " << fpratio << endl;
-
-		if(fpratio == 1) {
-			cout << "ERROR: fp = " << fpratio << endl;
+		int flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+		if (populate)
+			flags |= MAP_POPULATE;
+#endif
+		void *p = mmap(nullptr, st.st_size, PROT_READ, flags, fd, 0);
+		close(fd);
+		if (p == MAP_FAILED)
+			throw runtime_error("could not map cascade " + path);
+		map_ = p;
+		map_bytes_ = st.st_size;
+		if (!populate)
+			madvise(map_, map_bytes_, MADV_RANDOM);
+
+		const char *base = static_cast<const char *>(map_);
+		const bfc_file_header &h = *reinterpret_cast<const bfc_file_header *>(base);
+		const uint64_t size = map_bytes_;
+		if (memcmp(h.magic, bfc_file::magic, sizeof(h.magic)) != 0 || h.byte_order != bfc_file::byte_order ||
+			h.version != bfc_file::version || h.header_bytes != sizeof(h) || h.data_offset < sizeof(h) ||
+			h.data_offset % bfc_file::page ||
+			h.num_levels > (h.data_offset - sizeof(h)) / sizeof(bfc_file_level) || h.data_offset > size ||
+			h.data_bytes > size - h.data_offset) {
+			munmap(map_, map_bytes_);
+			throw runtime_error("not a cascade or corrupt: " + path);
+		}
+		const bfc_file_level *dir = reinterpret_cast<const bfc_file_level *>(base + sizeof(h));
+		if (bfc_file::header_crc(h, dir) != h.header_crc) {
+			munmap(map_, map_bytes_);
+			throw runtime_error("cascade header checksum mismatch: " + path);
+		}
+		bfc.resize(h.num_levels);
+		for (size_t i = 0; i < h.num_levels; i++) {
+			const bfc_file_level &l = dir[i];
+			BloomFilter<fp_type, fp_len> &bf = bfc[i];
+			// every bit position a lookup can reach has to lie inside the level
+			if (l.offset % bfc_file::level_align || l.offset > h.data_bytes || l.bytes > h.data_bytes - l.offset ||
+				l.n <= 0 || uint64_t(l.n) > l.bytes * 8 || l.shift != 3 || l.k < 0 || l.k > 20) {
+				munmap(map_, map_bytes_);
+				bfc.clear();
+				throw runtime_error("not a cascade or corrupt: " + path);
+			}
+			bf.n = l.n;
+			bf.m = l.m;
+			bf.shift = l.shift;
+			bf.k = l.k;
+			memcpy(bf.a, l.a, sizeof(bf.a));
+			bf.memory_consumption = l.bytes;
+			bf.T = const_cast<char *>(base + h.data_offset + l.offset);
+		}
+		num_items_ = h.num_items;
+		size_in_bytes = h.size_in_bytes;
+
+		if (verify) {
+			vector<const void *> data(bfc.size());
+			vector<size_t> bytes(bfc.size());
+			vector<uint32_t> crcs(bfc.size());
+			for (size_t i = 0; i < bfc.size(); i++) {
+				data[i] = bfc[i].T;
+				bytes[i] = bfc[i].memory_consumption;
+			}
+			madvise(map_, map_bytes_, MADV_SEQUENTIAL);
+			cuckoofilter::Crc32cRanges(data.data(), bytes.data(), bfc.size(), crcs.data());
+			madvise(map_, map_bytes_, MADV_RANDOM);
+			for (size_t i = 0; i < bfc.size(); i++)
+				if (crcs[i] != dir[i].crc) {
+					munmap(map_, map_bytes_);
+					bfc.clear();
+					throw runtime_error("cascade level " + to_string(i) + " checksum mismatch: " + path);
+				}
+		}
+	}
+
+	// deep copy, every level gets its own bit array (e.g. one replica per NUMA node, see
+	// vacuumpair/queryservice.hh)
+	BFCascade(const BFCascade &other) : bfc(other.bfc), size_in_bytes(other.size_in_bytes), num_items_(other.num_items_) {
+		for (auto &bf : bfc) {
+			char *T = (char *)malloc(bf.memory_consumption);
+			memcpy(T, bf.T, bf.memory_consumption);
+			bf.T = T;
+		}
+	}
+
+	BFCascade &operator=(const BFCascade &) = delete;
+
+    ~BFCascade() {
+		// the levels' bit arrays belong to the cascade, BloomFilter itself never frees them
+		if (map_) {
+			munmap(map_, map_bytes_);
 			return;
 		}
+		for (auto &bf : bfc)
+			free(bf.T);
+	}
 
-	    if(fp.size() > 0) { // RECURSION
-			lup.clear();
-	        insert(fp, ins, lup); 
-	    }
+	// writes the cascade to path (format above), next to it first and renamed over it when complete.
+	// Throws std::runtime_error on I/O errors
+	void save(const string &path) const {
+		bfc_file_header h;
+		memset(&h, 0, sizeof(h));
+		memcpy(h.magic, bfc_file::magic, sizeof(h.magic));
+		h.version = bfc_file::version;
+		h.byte_order = bfc_file::byte_order;
+		h.header_bytes = sizeof(h);
+		h.num_levels = bfc.size();
+		h.num_items = num_items_;
+		h.size_in_bytes = size_in_bytes;
+
+		vector<bfc_file_level> dir(bfc.size());
+		uint64_t end = 0;
+		for (size_t i = 0; i < bfc.size(); i++) {
+			const BloomFilter<fp_type, fp_len> &bf = bfc[i];
+			bfc_file_level &l = dir[i];
+			memset(&l, 0, sizeof(l));
+			l.n = bf.n;
+			l.m = bf.m;
+			l.shift = bf.shift;
+			l.k = bf.k;
+			memcpy(l.a, bf.a, sizeof(l.a));
+			l.offset = end;
+			l.bytes = bf.memory_consumption;
+			l.crc = cuckoofilter::Crc32c(bf.T, l.bytes);
+			end = bfc_file::round_up(end + l.bytes, bfc_file::level_align);
+		}
+		h.data_offset = bfc_file::round_up(sizeof(h) + sizeof(bfc_file_level) * dir.size(), bfc_file::page);
+		h.data_bytes = end;
+		h.header_crc = bfc_file::header_crc(h, dir.data());
+
+		const string tmp = path + ".tmp";
+		FILE *f = fopen(tmp.c_str(), "wb");
+		if (!f)
+			throw runtime_error("could not create cascade " + tmp);
+		bool ok = fwrite(&h, sizeof(h), 1, f) == 1 &&
+				  (dir.empty() || fwrite(dir.data(), sizeof(bfc_file_level), dir.size(), f) == dir.size());
+		for (size_t i = 0; ok && i < bfc.size(); i++)
+			ok = fseeko(f, h.data_offset + dir[i].offset, SEEK_SET) == 0 &&
+				 fwrite(bfc[i].T, 1, dir[i].bytes, f) == dir[i].bytes;
+		// up to the end of the last level's padding (or of the directory's page, without levels)
+		ok = ok && fflush(f) == 0 && ftruncate(fileno(f), h.data_offset + h.data_bytes) == 0;
+		// on disk before the rename, or a crash could leave path naming an empty or short file
+		ok = ok && fsync(fileno(f)) == 0;
+		ok = fclose(f) == 0 && ok;
+		if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+			unlink(tmp.c_str());
+			throw runtime_error("could not write cascade " + path);
+		}
+	}
+
+	bool mapped() const { return map_ != nullptr; }
+
+	void insert(const vector<uint64_t> &ins, const vector<uint64_t> &lup) {
+		insert(ins.data(), ins.size(), lup.data(), lup.size());
+	}
+
+	// builds the cascade from non-owning views of the inserted (revoked) and looked up (unrevoked) keys,
+	// e.g. mmap'd key files. Neither set is copied: each level only allocates its false positives, which
+	// are moved along to become the inserted keys of the next level
+	void insert(const uint64_t *ins, size_t n_ins, const uint64_t *lup, size_t n_lup) { // , FILE *file)
+		if (map_)
+			throw logic_error("a mapped cascade is read-only");
+		vector<uint64_t> level_ins; // backs ins once past the first level
+		vector<uint64_t> level_lup; // backs lup once past the second level
+
+		while (true) {
+			// max load factor of 95%
+			double max_lf = 0.95;
+			uint64_t init_size = n_ins / max_lf;
+
+			if (n_ins > num_items_)
+				num_items_ = n_ins;
+
+			BloomFilter<uint16_t, 15> bloomFilter;
+			bloomFilter.init(init_size, 1);
+			/*
+			if(bfc.size() & 1) { // odd = revoked
+				cout << "bf contains REVOKED: level " << bfc.size() << endl;
+			} 
+			else { // even = unrevoked
+				cout << "bf contains UNREVOKED: level " << bfc.size() << endl;
+			}
+			*/
+
+			for (size_t i = 0; i < n_ins; i++)
+				bloomFilter.insert(ins[i]);
+			bfc.push_back(bloomFilter);
+
+			// cout << "checking fp's: " << endl;
+			vector<uint64_t> fp;
+			for (size_t j = 0; j < n_lup; j++) {
+				if (bloomFilter.lookup(lup[j])) {
+					fp.push_back(lup[j]);
+					// cout << "fp: " << lup[j] << endl;
+				}
+			}
+			double fpratio = (double) fp.size() / n_lup;
+			size_in_bytes += bloomFilter.mem_cost();
+			// cout << "# false hits: " << fp.size() << '\n';
+			// cout << "fp: " << fpratio << '\n';
+			// fprintf(file, "level, insert, lookup, # fp's, fp, memory(bytes), bits per item\n");
+			printf("%lu, %lu, %lu, %lu, %.5f, %lu, %.5f\n", bfc.size(), n_ins, n_lup, fp.size(), fpratio, bloomFilter.mem_cost(), double(bloomFilter.mem_cost())/n_ins);
+			// fprintf(file, "%lu, %lu, %lu, %lu, %.5f, %lu, %.5f\n", bfc.size(), n_ins, n_lup, fp.size(), fpratio, bloomFilter.mem_cost(), double(bloomFilter.mem_cost())/n_ins);
+
+			if(fpratio == 1) {
+				cout << "ERROR: fp = " << fpratio << endl;
+				return;
+			}
+
+			if (fp.size() == 0)
+				break;
+
+			// next level inserts this level's false positives and looks up this level's inserted keys
+			level_lup = std::move(level_ins);
+			lup = ins;
+			n_lup = n_ins;
+			level_ins = std::move(fp);
+			ins = level_ins.data();
+			n_ins = level_ins.size();
+		}
 		// cout << "final # levels: " << bfc.size() << endl;
-		// cout << "insert " << ins.size() << " lookup " << lup.size() << " fp " << fp.size() << endl;
 	}
 
-	bool lookup(uint64_t e) { // true = revoked, false = unrevoked
+	bool lookup(uint64_t e) const { // true = revoked, false = unrevoked
 		// cout << "lookup: " << e << endl;
 		// cout << "lvls: " << bfc.size() << endl;
 	    int l = 1; // track level
-		for (BloomFilter<fp_type, fp_len> bf: bfc) {
+		for (const BloomFilter<fp_type, fp_len> &bf: bfc) {
 	        // cout << "level " << l << ": ";
 			// cout << "size " << it.size() << endl;
 	        if (!bf.lookup(e)) {
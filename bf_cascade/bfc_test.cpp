@@ -19,13 +19,13 @@ double time_cost(chrono::steady_clock::time_point &start,
     return elapsedSeconds;
 }
 
-void test_bfc(vector<uint64_t> r, vector<uint64_t> s, vector<uint64_t> fp, FILE *file) {
+void test_bfc(const vector<uint64_t> &r, const vector<uint64_t> &s, FILE *file) {
     BFCascade<uint16_t, 15> bfc;
     fprintf(file, "Bloom Filter Cascade\n");
     fprintf(file, "level, insert, lookup, # fp's, fp, memory(bytes), bits per item\n");
     cout << "start bfc insert" << endl;
     auto start = chrono::steady_clock::now();  
-    bfc.insert(r, s, fp); // , file
+    bfc.insert(r, s); // , file
     auto end = chrono::steady_clock::now();
     cout << "finish bfc insert" << endl;
     double cost = time_cost(start, end);
@@ -85,7 +85,6 @@ void read_cert(int f) {
     ifstream unrevoked(unrevoked_filename); // 50000 , final_unrevoked.txt 29725064
     vector<uint64_t> r; // revoked 
     vector<uint64_t> s; // unrevoked
-    vector<uint64_t> fp; // track false positives  
 
     FILE *file = fopen("bfc_test_fp.csv", "a");  // to print all stats to a file
     if (file == NULL)
@@ -116,7 +115,7 @@ void read_cert(int f) {
     // cout << "# unrevoked: " << s.size() << " cap: " << s.capacity() << '\n';
     // cout << "# fp's: " << fp.size() << " cap: " << fp.capacity() << '\n';
 
-    test_bfc(r, s, fp, file);
+    test_bfc(r, s, file);
 
     fprintf(file, "\n");
     fclose(file);
@@ -91,7 +91,7 @@ class BloomFilter //: public Filter<fp_t, fp_len>
     int a[20];
     char *T;
 	// ~BloomFilter() { free(T); }
-    uint64_t position_hash(long long ele) {
+    uint64_t position_hash(long long ele) const {
         return (ele % n + n) % n;
     }
 
@@ -130,11 +130,11 @@ class BloomFilter //: public Filter<fp_t, fp_len>
     {
         T[pos >> shift] |= (1LL << (pos & ((1LL << shift) - 1)));
     }
-    bool get_item(uint64_t pos)
+    bool get_item(uint64_t pos) const
     {
         return (T[pos >> shift] & (1LL << (pos & ((1LL << shift) - 1)))) > 0;
     }
-    uint64_t hash64(uint64_t ele)
+    uint64_t hash64(uint64_t ele) const
     {
         //return (uint64_t(HashUtil::MurmurHash32(ele)) << 32) + (uint64_t(HashUtil::MurmurHash32(ele ^ 0x9128211)));
         return HashUtil::MurmurHash64(ele);
@@ -169,7 +169,7 @@ class BloomFilter //: public Filter<fp_t, fp_len>
         */
         return 0;
     }
-    bool lookup(uint64_t ele)
+    bool lookup(uint64_t ele) const
     {
         // printf("looking for %lu\n", ele);
         for (int i = 0; i < k; i++)
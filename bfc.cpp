@@ -3,6 +3,9 @@
 #include <unistd.h>
 #include "bf_cascade/hashutil.h"
 #include "bf_cascade/bf_cascade.h"
+#include "vacuumpair/queryservice.hh"
+#include "vacuumpair/certloader.hh"
+#include "vacuumpair/keyset.hh"
 #include <time.h>
 #include <string>
 // using std::string;
@@ -33,36 +36,25 @@ void random_gen(int n, vector<uint64_t> &store, mt19937 &rd)
 
 void read_cert(vector<uint64_t> &r, vector<uint64_t> &s)
 {
-    string line;
     string revoked_filename = "final_revoked_unique.txt";
     string unrevoked_filename = "final_unrevoked_unique.txt";
 
-    ifstream revoked(revoked_filename);     // 500 , final_revoked.txt 27496
-    ifstream unrevoked(unrevoked_filename); // 50000 , final_unrevoked.txt 29725064
-
-    auto start = chrono::steady_clock::now();
-    while (getline(revoked, line))
-    {                                                 // gets revoked line by line, saves in string
-        uint64_t i = stoul(line.c_str(), nullptr, 0); // convert string to long
-        r.push_back(i);
+    if (access("final_revoked_unique.keys", R_OK) == 0 && access("final_unrevoked_unique.keys", R_OK) == 0)
+    { // made by ./keyset from the lists above
+        auto start = chrono::steady_clock::now();
+        keyset("final_revoked_unique.keys").read_all(r);
+        keyset("final_unrevoked_unique.keys").read_all(s);
+        auto end = chrono::steady_clock::now();
+        cout << "time cost for read: " << time_cost(start, end) << " (key sets)" << endl;
+        return;
     }
-    revoked.close();
 
-    while (getline(unrevoked, line))
-    { // gets unrevoked line by line
-        uint64_t l = stoul(line.c_str(), nullptr, 0);
-        s.push_back(l);
-    }
-    unrevoked.close();
-    auto end = chrono::steady_clock::now();
-    double cost = time_cost(start, end);
-    cout << "time cost for read: " << cost << endl;
-
-    // fprintf(file, "revoked, unrevoked\n");
-    // fprintf(file, "%lu, %lu\n", r.size(), s.size());
-    // cout << "# revoked: " << r.size() << " cap: " << r.capacity() << '\n';
-    // cout << "# unrevoked: " << s.size() << " cap: " << s.capacity() << '\n';
-    // cout << "# fp's: " << fp.size() << " cap: " << fp.capacity() << '\n';
+    cert_load_stats revoked = load_cert_file(revoked_filename, r);
+    cert_load_stats unrevoked = load_cert_file(unrevoked_filename, s);
+    double cost = revoked.seconds + unrevoked.seconds;
+    printf("time cost for read: %.3f s, revoked: %zu, unrevoked: %zu, %.1f MB/s, %.1f Mkeys/s, %zu threads\n", cost,
+           revoked.keys, unrevoked.keys, (revoked.bytes + unrevoked.bytes) / 1048576.0 / cost,
+           (revoked.keys + unrevoked.keys) / 1000000.0 / cost, revoked.threads);
 }
 
 void test_size_lookup(int n = 0, int q = 0, int rept = 1)
@@ -105,7 +97,6 @@ void test_size_lookup(int n = 0, int q = 0, int rept = 1)
             int p = min(q, lim) * 100;
             int k = 0;
             vector<uint64_t> lupKey;
-            vector<uint64_t> fp; // track false positives
             random_gen(lim, insKey, rd);
             random_gen(p, lupKey, rd);
             // for (; i < lim; i++)
@@ -119,7 +110,7 @@ void test_size_lookup(int n = 0, int q = 0, int rept = 1)
             // insertions take both insert and lookup sets as input
             // to generate more cascade levels upon finding false positive's
             printf("level, insert, lookup, # fp's, fp, memory(bytes), bits per item\n"); // temp. method of formatting stdout since insert() is recursive
-            bfc.insert(insKey, lupKey, fp);
+            bfc.insert(insKey, lupKey);
 
             cout << "total cascade size (bytes): " << bfc.num_bytes() << "\n";
             lvls[0][j] = bfc.num_levels();
@@ -180,7 +171,6 @@ void test_cert_lookup(int n = 0, int q = 0, int rept = 1)
 
     vector<uint64_t> insKey; // revoked
     vector<uint64_t> lupKey; // unrevoked
-    vector<uint64_t> fp;     // track false positives
 
     read_cert(insKey, lupKey);
 
@@ -221,7 +211,7 @@ void test_cert_lookup(int n = 0, int q = 0, int rept = 1)
         // insertions take both insert and lookup sets as input
         // to generate more cascade levels upon finding false positive's
         printf("level, insert, lookup, # fp's, fp, memory(bytes), bits per item\n"); // temp. method of formatting stdout since insert() is recursive
-        bfc.insert(insKey, lupKey, fp);
+        bfc.insert(insKey, lupKey);
 
         cout << "total cascade size (bytes): " << bfc.num_bytes() << "\n";
         printf("insert done\n");
@@ -289,11 +279,171 @@ void test_cert_lookup(int n = 0, int q = 0, int rept = 1)
     fprintf(out, "\n");
 }
 
+// lookup throughput of one built cascade through query_service from 1 to all cpus, with every thread
+// reading the same cascade and with one replica of the cascade per NUMA node
+void test_thread_scaling(int n = 0, int q = 0, int rept = 1)
+{
+    FILE *out = fopen("bfc_thread_scaling.csv", "a");
+    assert(out != NULL);
+
+    if (n == 0)
+        n = 1000000;
+    if (q == 0)
+        q = 100000000;
+    int seed = 1;
+
+    mt19937 rd(seed);
+    vector<uint64_t> insKey, lupKey;
+    random_gen(n, insKey, rd);
+    random_gen(q, lupKey, rd);
+
+    typedef BFCascade<uint16_t, 15> bfc_t;
+    bfc_t bfc;
+    bfc.insert(insKey, lupKey);
+
+    // queries: all of S and R, the cascade reports exactly the keys of R as revoked
+    vector<uint64_t> queries(lupKey);
+    queries.insert(queries.end(), insKey.begin(), insKey.end());
+    bool *res = new bool[queries.size()];
+
+    auto lookup_many = [](const bfc_t &f, const uint64_t *keys, size_t m, bool *result) {
+        for (size_t i = 0; i < m; i++)
+            result[i] = f.lookup(keys[i]);
+    };
+
+    numa_topology topo = numa_topology::detect();
+    int cpus = topo.num_cpus();
+    printf("bfc thread scaling: %d cpus on %zu NUMA nodes\n", cpus, topo.num_nodes());
+    fprintf(out, "threads, bfc shared, bfc replicated, nodes = %zu, item numbers = %d, query number = %zu\n", topo.num_nodes(), n, queries.size());
+
+    for (int t = 1;; t = min(t * 2, cpus))
+    {
+        double mop[2];
+        for (int replicate = 0; replicate < 2; replicate++)
+        {
+            query_service<bfc_t> service(bfc, lookup_many, t, replicate);
+            mop[replicate] = 0;
+            for (int r = 0; r < rept; r++)
+            {
+                auto start = chrono::steady_clock::now();
+                service.lookup_many(queries.data(), queries.size(), res);
+                auto end = chrono::steady_clock::now();
+                mop[replicate] += double(queries.size()) / 1000000.0 / time_cost(start, end) / rept;
+            }
+            int lookup_number = count(res, res + queries.size(), true);
+            assert(lookup_number == n);
+            printf("threads = %d, replicas = %zu: %.5f Mops, lookup_number = %d\n", t, service.num_replicas(), mop[replicate], lookup_number);
+        }
+        fprintf(out, "%d, %.5f, %.5f\n", t, mop[0], mop[1]);
+        if (t == cpus)
+            break;
+    }
+
+    delete[] res;
+    fclose(out);
+}
+
+// build the cascade once and save it (BFCascade::save), then start from the file instead: time to map
+// it against the time insert takes, and lookups over the mapping, the first batch paying its page faults.
+// Also the time to map it with its checksums verified, and that a flipped bit is caught
+void test_save_map(int n = 0, int q = 0, const string &path = "bfc_cascade.bin")
+{
+    FILE *out = fopen("bfc_save_map.csv", "a");
+    assert(out != NULL);
+
+    if (n == 0)
+        n = 1000000;
+    if (q == 0)
+        q = 10000000;
+    int seed = 1;
+
+    mt19937 rd(seed);
+    vector<uint64_t> insKey, lupKey;
+    random_gen(n, insKey, rd);
+    random_gen(q, lupKey, rd);
+
+    typedef BFCascade<uint16_t, 15> bfc_t;
+    auto start = chrono::steady_clock::now();
+    bfc_t bfc;
+    bfc.insert(insKey, lupKey);
+    auto end = chrono::steady_clock::now();
+    double build = time_cost(start, end);
+
+    start = chrono::steady_clock::now();
+    bfc.save(path);
+    end = chrono::steady_clock::now();
+    double save = time_cost(start, end);
+
+    start = chrono::steady_clock::now();
+    bfc_t mapped(path, false, false);
+    end = chrono::steady_clock::now();
+    double open = time_cost(start, end);
+
+    start = chrono::steady_clock::now();
+    {
+        bfc_t checked(path);
+    }
+    end = chrono::steady_clock::now();
+    double verified = time_cost(start, end);
+
+    {
+        // one bit of the first level flipped in a copy of the file
+        ifstream in(path, ios::binary);
+        string bytes((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+        const bfc_file_header &h = *reinterpret_cast<const bfc_file_header *>(bytes.data());
+        const bfc_file_level &l = *reinterpret_cast<const bfc_file_level *>(bytes.data() + sizeof(h));
+        bytes[h.data_offset + l.offset + l.bytes / 2] ^= 4;
+        ofstream(path + ".bad", ios::binary) << bytes;
+        bool rejected = false;
+        try
+        {
+            bfc_t bad(path + ".bad");
+        }
+        catch (const runtime_error &)
+        {
+            rejected = true;
+        }
+        assert(rejected);
+        unlink((path + ".bad").c_str());
+    }
+
+    const int batch = 4096;
+    int lookup_number = 0;
+    start = chrono::steady_clock::now();
+    for (int i = 0; i < batch; i++)
+        lookup_number += mapped.lookup(lupKey[i]);
+    end = chrono::steady_clock::now();
+    double first = time_cost(start, end);
+
+    start = chrono::steady_clock::now();
+    for (int i = batch; i < q; i++)
+        lookup_number += mapped.lookup(lupKey[i]);
+    end = chrono::steady_clock::now();
+    double rest = time_cost(start, end);
+
+    // S is what the cascade was built against, none of it is reported revoked
+    assert(lookup_number == 0);
+    for (auto k : insKey)
+        assert(mapped.lookup(k));
+
+    struct stat st;
+    stat(path.c_str(), &st);
+    printf("build %.3f s, save %.3f s, map %.3f ms, verified map %.3f ms (%.2f GB/s), first %d lookups %.3f ms, %.5f Mops after, %d levels, %.2f MB file\n",
+           build, save, open * 1000, verified * 1000, st.st_size / 1e9 / verified, batch, first * 1000, (q - batch) / 1000000.0 / rest,
+           mapped.num_levels(), st.st_size / 1048576.0);
+    fprintf(out, "build s, save s, map ms, verified map ms, first batch ms, Mops, levels, file MB, item numbers = %d, query number = %d\n", n, q);
+    fprintf(out, "%.5f, %.5f, %.5f, %.5f, %.5f, %.5f, %d, %.2f\n", build, save, open * 1000, verified * 1000, first * 1000,
+            (q - batch) / 1000000.0 / rest, mapped.num_levels(), st.st_size / 1048576.0);
+    fclose(out);
+}
+
 int main(int argc, char *argv[])
 {
     int rept = 1;
     test_size_lookup(10000000, 1000000000, rept);
     // test_cert_lookup(0, 0, rept);
+    // test_thread_scaling(1000000, 100000000, 3);
+    // test_save_map(1000000, 10000000);
 
     return 0;
 }
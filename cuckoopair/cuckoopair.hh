@@ -27,14 +27,17 @@ public:
     cuckoofilter::CuckooFilter<KeyType, bits_per_fp, Hash> *filter_;
 
 public:
-    explicit cuckoopair(vector<KeyType> r, vector<KeyType> s) : num_items_(r.size())
+    explicit cuckoopair(const vector<KeyType> &r, const vector<KeyType> &s) : cuckoopair(r.data(), r.size(), s.data(), s.size()) {}
+
+    // builds from non-owning views of R and S (e.g. mmap'd key files), neither set is copied
+    cuckoopair(const KeyType *r, size_t r_size, const KeyType *s, size_t s_size) : num_items_(r_size)
     {
-        size_ = r.size() / 0.95;
+        size_ = r_size / 0.95;
         table_ = new cuckoohashtable::cuckoo_hashtable<KeyType, bits_per_fp, Hash>(size_);
-        insert_hashtable(r);
-        fn_lookup_hashtable(r);
+        insert_hashtable(r, r_size);
+        fn_lookup_hashtable(r, r_size);
 
-        zero_fp_rehash(r, s);
+        zero_fp_rehash(r, r_size, s, s_size);
 
         vector<vector<KeyType>> fp_table;
         table_->export_table(fp_table);
@@ -43,7 +46,7 @@ public:
 
         insert_filter(fp_table);
 
-        check_lookup_filter(r, s);
+        check_lookup_filter(r, r_size, s, s_size);
 
         cout << "complete!\n";
 
@@ -57,20 +60,24 @@ public:
     // }
 
     template <typename K>
-    void insert_hashtable(vector<K> &r)
+    void insert_hashtable(const K *r, size_t n)
     {
         // add set R to table
-        for (K c : r)
+        for (size_t i = 0; i < n; i++)
+        {
+            K c = r[i]; // insert() cuckoos through its key argument
             table_->insert(c);
+        }
         cout << "Hashtable: finish inserting " << table_->size() << " items\n";
     }
 
     template <typename K>
-    void fn_lookup_hashtable(vector<K> &r)
+    void fn_lookup_hashtable(const K *r, size_t n)
     {
         // check for false negatives with set R
-        for (KeyType c : r)
+        for (size_t i = 0; i < n; i++)
         {
+            KeyType c = r[i];
             std::pair<int32_t, int32_t> indices = table_->lookup(c);
             assert(indices.first >= 0 || indices.second >= 0);
             assert(table_->find(c).first >= 0); // first = index, second = slot
@@ -78,7 +85,7 @@ public:
     }
 
     template <typename K>
-    void zero_fp_rehash(vector<K> &r, vector<K> &s)
+    void zero_fp_rehash(const K *r, size_t r_size, const K *s, size_t s_size)
     {
         int total_rehash = 0;
 
@@ -89,8 +96,9 @@ public:
             size_t definite_queries = 0;
 
             table_->start_lookup();
-            for (K l : s)
+            for (size_t i = 0; i < s_size; i++)
             {
+                K l = s[i];
                 if (table_->find(l).first >= 0)
                     definite_queries++;
                 total_queries++;
@@ -146,18 +154,18 @@ public:
     }
 
     template <typename K>
-    void check_lookup_filter(vector<K> &r, vector<K> &s)
+    void check_lookup_filter(const K *r, size_t r_size, const K *s, size_t s_size)
     {
         // check no false negatives - failing here with sizes above 10k :(
         cout << "\nChecking CF false negatives:\n";
-        for (auto c : r)
-            assert(filter_->Contain(c) == cuckoofilter::Ok);
+        for (size_t i = 0; i < r_size; i++)
+            assert(filter_->Contain(r[i]) == cuckoofilter::Ok);
 
         size_t total_queries = 0;
         size_t false_queries = 0;
-        for (auto l : s)
+        for (size_t i = 0; i < s_size; i++)
         {
-            if (filter_->Contain(l) == cuckoofilter::Ok)
+            if (filter_->Contain(s[i]) == cuckoofilter::Ok)
                 false_queries++;
             total_queries++;
         }
@@ -0,0 +1,95 @@
+#include <bits/stdc++.h>
+#include "vacuumpair/certloader.hh"
+#include "vacuumpair/keyset.hh"
+
+using namespace std;
+
+// converts key sets into the binary format of vacuumpair/keyset.hh, which vp and bfc map instead of
+// parsing the text lists or generating keys on every run:
+//   keyset [-s] [-z] in.txt out.keys   certificate list (one serial per line), -s sorted, -z sorted
+//                                      and varint compressed
+//   keyset [-s] [-z] -r n seed out.keys
+//                                      the n keys random_gen(n, keys, rd) gives with mt19937 rd(seed)
+//   keyset -i file.keys                header and provenance of a key set
+
+// generate n 64-bit random numbers for running insert & lookup, as in vp.cc and bfc.cpp
+void random_gen(int n, vector<uint64_t> &store, mt19937 &rd)
+{
+    store.resize(n);
+    for (int i = 0; i < n; i++)
+        store[i] = (uint64_t(rd()) << 32) + rd();
+}
+
+int usage()
+{
+    fprintf(stderr, "usage: keyset [-s] [-z] in.txt out.keys\n"
+                    "       keyset [-s] [-z] -r n seed out.keys\n"
+                    "       keyset -i file.keys\n");
+    return 1;
+}
+
+int info(const string &path)
+{
+    keyset ks(path);
+    const keyset_header &h = ks.header();
+    time_t created = h.created;
+    printf("%s: %lu keys, %s%s, %lu payload bytes (%.2f bytes/key), keys %#lx .. %#lx\n", path.c_str(),
+           h.count, ks.sorted() ? "sorted" : "unsorted", ks.compressed() ? ", varint" : "",
+           h.payload_bytes, h.count ? double(h.payload_bytes) / h.count : 0.0, h.min_key, h.max_key);
+    printf("written %s", ctime(&created));
+    printf("provenance: %s\n", ks.provenance().c_str());
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned flags = 0;
+    bool random = false;
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-'; i++)
+    {
+        string opt = argv[i];
+        if (opt == "-s")
+            flags |= keyset_sorted;
+        else if (opt == "-z")
+            flags |= keyset_sorted | keyset_varint;
+        else if (opt == "-r")
+            random = true;
+        else if (opt == "-i" && i + 2 == argc)
+            return info(argv[i + 1]);
+        else
+            return usage();
+    }
+
+    vector<uint64_t> keys;
+    stringstream provenance;
+    string out;
+    auto start = chrono::steady_clock::now();
+    if (random)
+    {
+        if (argc - i != 3)
+            return usage();
+        int n = atoi(argv[i]);
+        unsigned seed = strtoul(argv[i + 1], nullptr, 0);
+        mt19937 rd(seed);
+        random_gen(n, keys, rd);
+        provenance << "random_gen(" << n << ") with mt19937(" << seed << ")";
+        out = argv[i + 2];
+    }
+    else
+    {
+        if (argc - i != 2)
+            return usage();
+        cert_load_stats st = load_cert_file(argv[i], keys);
+        printf("read %zu keys in %.3f s (%.1f MB/s)\n", st.keys, st.seconds, st.mb_per_s());
+        struct stat sb;
+        stat(argv[i], &sb);
+        provenance << "text " << argv[i] << " (" << sb.st_size << " bytes, modified " << sb.st_mtime << ")";
+        out = argv[i + 1];
+    }
+
+    write_keyset(out, keys.data(), keys.size(), flags, provenance.str());
+    auto end = chrono::steady_clock::now();
+    printf("wrote %s in %.3f s\n", out.c_str(), chrono::duration<double>(end - start).count());
+    return info(out);
+}
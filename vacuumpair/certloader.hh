@@ -0,0 +1,307 @@
+#ifndef CERT_LOADER_HH
+#define CERT_LOADER_HH
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+idea: load the certificate serial lists (final_revoked_unique.txt, final_unrevoked_unique.txt, one
+serial per line, hex with 0x or decimal as stoul(line, nullptr, 0) reads them) without getline/stoul.
+The file is mapped and cut into one chunk per thread at line ends. Every thread counts the lines of
+its chunk, the key array is sized once from the counts, then every thread parses its chunk straight
+into its part of the array. Lines are parsed 8 digits at a time in a 64-bit word (SWAR)
+*/
+
+struct cert_load_stats
+{
+    size_t keys;
+    size_t bytes;
+    size_t threads;
+    double seconds;
+
+    double mb_per_s() const { return seconds > 0 ? bytes / 1048576.0 / seconds : 0; }
+    double mkeys_per_s() const { return seconds > 0 ? keys / 1000000.0 / seconds : 0; }
+};
+
+namespace cert_parse
+{
+    const uint64_t kOnes = 0x0101010101010101ULL;
+    const uint64_t kHighs = 0x8080808080808080ULL;
+
+    inline uint64_t load8(const char *p)
+    {
+        uint64_t w;
+        memcpy(&w, p, sizeof(w));
+        return w;
+    }
+
+    // high bit of every byte of w (7-bit ascii) that lies in [lo, hi]
+    inline uint64_t in_range(uint64_t w, unsigned char lo, unsigned char hi)
+    {
+        const uint64_t x = w | kHighs; // keeps the subtractions within their bytes
+        return (x - kOnes * lo) & ~(x - kOnes * (hi + 1)) & kHighs;
+    }
+
+    // the n <= 8 characters before end, in the high bytes of a word (the first one lowest), the
+    // bytes in front of them cleared. end - 8 must be readable
+    inline uint64_t load_tail(const char *end, size_t n, uint64_t &keep)
+    {
+        keep = ~0ULL << (8 * (8 - n));
+        return load8(end - 8) & keep;
+    }
+
+    // value of the n (1 to 8) hex digits before end, false when one is not a hex digit
+    inline bool hex8(const char *end, size_t n, uint64_t &v)
+    {
+        uint64_t keep;
+        const uint64_t w = load_tail(end, n, keep);
+        const uint64_t digit = in_range(w, '0', '9') | in_range(w | (kOnes * 0x20), 'a', 'f');
+        if ((digit & keep) != (kHighs & keep) || (w & kHighs))
+            return false;
+        // '0'-'9' -> 0-9, 'a'-'f' / 'A'-'F' -> 10-15, then gather the nibbles with the last
+        // digit lowest
+        uint64_t x = __builtin_bswap64(((w & kOnes * 0x0f) + ((w >> 6) & kOnes) * 9) & keep);
+        x = (x & 0x000f000f000f000fULL) | ((x & 0x0f000f000f000f00ULL) >> 4);
+        x = (x & 0x000000ff000000ffULL) | ((x & 0x00ff000000ff0000ULL) >> 8);
+        v = (x & 0xffff) | ((x >> 16) & 0xffff0000ULL);
+        return true;
+    }
+
+    // value of the n (1 to 8) decimal digits before end, false when one is not a digit
+    inline bool dec8(const char *end, size_t n, uint64_t &v)
+    {
+        uint64_t keep;
+        const uint64_t w = load_tail(end, n, keep);
+        if ((in_range(w, '0', '9') & keep) != (kHighs & keep) || (w & kHighs))
+            return false;
+        // 8 digits, the first one in the lowest byte (as in simdjson's parse_eight_digits)
+        uint64_t x = w - (kOnes * '0' & keep);
+        x = x * 10 + (x >> 8);
+        v = (((x & 0x000000ff000000ffULL) * (100 + (1000000ULL << 32))) +
+             (((x >> 16) & 0x000000ff000000ffULL) * (1 + (10000ULL << 32)))) >> 32;
+        return true;
+    }
+
+    // stoul(line, nullptr, 0) for the odd line, same value and same exceptions: leading blanks, a
+    // sign (a minus negates modulo 2^64, as strtoul does), 0x only when a hex digit follows (else
+    // the 0 is the number, "0x" and "0xg" are 0), octal, 20 digits, trailing junk
+    inline uint64_t parse_slow(const char *p, const char *end)
+    {
+        const char *line = p;
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\v' || *p == '\f' || *p == '\r'))
+            p++;
+        bool negative = false;
+        if (p < end && (*p == '+' || *p == '-'))
+            negative = *p++ == '-';
+        auto digit = [](unsigned char c) -> unsigned {
+            if (c - '0' < 10u)
+                return c - '0';
+            if ((c | 0x20) - 'a' < 6u)
+                return (c | 0x20) - 'a' + 10;
+            return 16;
+        };
+        unsigned base = 10;
+        if (end - p >= 3 && p[0] == '0' && (p[1] | 0x20) == 'x' && digit(p[2]) < 16)
+        {
+            base = 16;
+            p += 2;
+        }
+        else if (p < end && p[0] == '0')
+            base = 8;
+        const char *first = p;
+        uint64_t v = 0;
+        for (unsigned d; p < end && (d = digit(*p)) < base; p++)
+            if (__builtin_mul_overflow(v, (uint64_t)base, &v) || __builtin_add_overflow(v, (uint64_t)d, &v))
+                throw std::out_of_range("certificate serial does not fit 64 bits: " + std::string(line, end));
+        if (p == first)
+            throw std::invalid_argument("not a certificate serial: " + std::string(line, end));
+        return negative ? -v : v;
+    }
+
+    // serial on the line [p, end) without its newline. begin is the start of the buffer: the word
+    // loads reach up to 16 bytes before a line's last digit, lines too close to it go the slow way
+    inline uint64_t parse_line(const char *begin, const char *p, const char *end)
+    {
+        const size_t n = end - p;
+        uint64_t hi, lo;
+        if (p - begin >= 16)
+        {
+            if (n >= 3 && p[0] == '0' && (p[1] | 0x20) == 'x' && n - 2 <= 16)
+            {
+                const size_t digits = n - 2;
+                if (digits <= 8)
+                {
+                    if (hex8(end, digits, lo))
+                        return lo;
+                }
+                else if (hex8(end - 8, digits - 8, hi) && hex8(end, 8, lo))
+                    return hi << 32 | lo;
+            }
+            else if (n >= 1 && n <= 16 && p[0] != '0')
+            {
+                if (n <= 8)
+                {
+                    if (dec8(end, n, lo))
+                        return lo;
+                }
+                else if (dec8(end - 8, n - 8, hi) && dec8(end, 8, lo))
+                    return hi * 100000000ULL + lo;
+            }
+        }
+        return parse_slow(p, end);
+    }
+
+    // newlines in [p, end)
+    inline size_t count_lines(const char *p, const char *end)
+    {
+        size_t n = 0;
+#ifdef __AVX2__
+        const __m256i nl = _mm256_set1_epi8('\n');
+        for (; p + 32 <= end; p += 32)
+            n += __builtin_popcount(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)p), nl)));
+#endif
+        return n + std::count(p, end, '\n');
+    }
+
+    // parses the lines of [p, end) into out, skipping blank ones, returns the number of keys
+    template <typename KeyType>
+    size_t parse_chunk(const char *begin, const char *p, const char *end, KeyType *out)
+    {
+        KeyType *o = out;
+        while (p < end)
+        {
+            const char *nl = static_cast<const char *>(memchr(p, '\n', end - p));
+            const char *next = nl ? nl + 1 : end;
+            const char *e = nl ? nl : end;
+            if (e > p && e[-1] == '\r')
+                e--;
+            if (e > p)
+                *o++ = static_cast<KeyType>(parse_line(begin, p, e));
+            p = next;
+        }
+        return o - out;
+    }
+}
+
+// appends the serials in path to keys, parsed by num_threads threads (0 = one per cpu, fewer for
+// small files). Throws std::runtime_error when path cannot be read and std::invalid_argument /
+// std::out_of_range for a line stoul would reject
+template <typename KeyType>
+cert_load_stats load_cert_file(const std::string &path, std::vector<KeyType> &keys, size_t num_threads = 0)
+{
+    auto start = std::chrono::steady_clock::now();
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw std::runtime_error("could not open certificate file " + path);
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
+        throw std::runtime_error("could not stat certificate file " + path);
+    }
+    const size_t size = st.st_size;
+    const char *data = nullptr;
+    if (size > 0)
+    {
+        void *p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED)
+        {
+            close(fd);
+            throw std::runtime_error("could not map certificate file " + path);
+        }
+        madvise(p, size, MADV_SEQUENTIAL);
+        data = static_cast<const char *>(p);
+    }
+    close(fd);
+
+    if (num_threads == 0)
+        num_threads = std::max(1u, std::thread::hardware_concurrency());
+    const size_t min_chunk = 1 << 20;
+    num_threads = std::max<size_t>(1, std::min(num_threads, size / min_chunk));
+
+    // chunk t is [cut[t], cut[t + 1]), every cut right after a newline
+    std::vector<size_t> cut(num_threads + 1, size);
+    cut[0] = 0;
+    for (size_t t = 1; t < num_threads; t++)
+    {
+        size_t c = std::max(cut[t - 1], size / num_threads * t);
+        const void *nl = c < size ? memchr(data + c, '\n', size - c) : nullptr;
+        cut[t] = nl ? static_cast<const char *>(nl) - data + 1 : size;
+    }
+
+    // a line per newline, plus an unterminated last one
+    std::vector<size_t> lines(num_threads + 1, 0);
+    auto run = [&](std::function<void(size_t)> f) {
+        std::vector<std::thread> workers;
+        for (size_t t = 1; t < num_threads; t++)
+            workers.push_back(std::thread(f, t));
+        f(0);
+        for (auto &w : workers)
+            w.join();
+    };
+    run([&](size_t t) { lines[t + 1] = cert_parse::count_lines(data + cut[t], data + cut[t + 1]); });
+    if (size > 0 && data[size - 1] != '\n')
+        lines[num_threads]++;
+    for (size_t t = 0; t < num_threads; t++)
+        lines[t + 1] += lines[t];
+
+    const size_t old = keys.size();
+    keys.resize(old + lines[num_threads]);
+    std::vector<size_t> parsed(num_threads, 0);
+    std::exception_ptr error;
+    std::mutex error_mutex;
+    run([&](size_t t) {
+        try
+        {
+            parsed[t] = cert_parse::parse_chunk(data, data + cut[t], data + cut[t + 1], keys.data() + old + lines[t]);
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(error_mutex);
+            error = std::current_exception();
+        }
+    });
+    if (data)
+        munmap(const_cast<char *>(data), size);
+    if (error)
+    {
+        keys.resize(old);
+        std::rethrow_exception(error);
+    }
+
+    // blank lines left gaps at the end of their chunks
+    size_t n = old + parsed[0];
+    for (size_t t = 1; t < num_threads; t++)
+    {
+        std::copy(keys.begin() + old + lines[t], keys.begin() + old + lines[t] + parsed[t], keys.begin() + n);
+        n += parsed[t];
+    }
+    keys.resize(n);
+
+    auto end = std::chrono::steady_clock::now();
+    cert_load_stats stats;
+    stats.keys = n - old;
+    stats.bytes = size;
+    stats.threads = num_threads;
+    stats.seconds = std::chrono::duration<double>(end - start).count();
+    return stats;
+}
+
+#endif // CERT_LOADER_HH
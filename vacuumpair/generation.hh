@@ -0,0 +1,200 @@
+#ifndef GENERATION_HH
+#define GENERATION_HH
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/*
+idea: hot swap of filter generations (e.g. the daily rebuild of the revocation filter) while lookups
+go on. Readers never lock: they announce the epoch they read in, load the current generation and
+clear their epoch when done. A writer publishes the next generation with one atomic exchange and
+deletes an old one only once no reader is left in an epoch that could still see it (epoch based
+reclamation)
+*/
+
+// Filter is any object readers look up in, owned by the manager once published
+template <typename Filter, size_t MAX_READERS = 256>
+class generation_manager
+{
+private:
+    // one reader's announced epoch, 0 while it is not reading. On its own cache line so readers do
+    // not share lines with each other
+    struct alignas(64) reader_slot
+    {
+        std::atomic<uint64_t> epoch;
+        std::atomic<bool> used;
+    };
+
+    struct retired
+    {
+        Filter *filter;
+        uint64_t epoch; // last epoch in which readers could have loaded it
+    };
+
+    std::atomic<Filter *> current_;
+    std::atomic<uint64_t> epoch_;        // global epoch, starts at 1
+    std::atomic<uint64_t> generation_;   // number of publish() calls
+    reader_slot slots_[MAX_READERS];
+
+    std::mutex writer_mutex_;            // publish/reclaim only, never taken by readers
+    std::vector<retired> retired_;
+
+    size_t acquire_slot()
+    {
+        for (size_t i = 0; i < MAX_READERS; i++)
+        {
+            bool expected = false;
+            if (!slots_[i].used.load(std::memory_order_relaxed) &&
+                slots_[i].used.compare_exchange_strong(expected, true))
+                return i;
+        }
+        throw std::runtime_error("generation_manager: more than MAX_READERS readers");
+    }
+
+    void release_slot(size_t i)
+    {
+        slots_[i].epoch.store(0);
+        slots_[i].used.store(false);
+    }
+
+    // smallest epoch any reader is in right now, or UINT64_MAX without readers
+    uint64_t min_reader_epoch() const
+    {
+        uint64_t m = UINT64_MAX;
+        for (size_t i = 0; i < MAX_READERS; i++)
+        {
+            uint64_t e = slots_[i].epoch.load();
+            if (e != 0 && e < m)
+                m = e;
+        }
+        return m;
+    }
+
+    // with writer_mutex_ held
+    size_t reclaim_locked()
+    {
+        const uint64_t m = min_reader_epoch();
+        size_t kept = 0;
+        for (size_t i = 0; i < retired_.size(); i++)
+        {
+            // readers in an epoch after it was retired can only have loaded a newer generation
+            if (retired_[i].epoch < m)
+                delete retired_[i].filter;
+            else
+                retired_[kept++] = retired_[i];
+        }
+        retired_.resize(kept);
+        return kept;
+    }
+
+public:
+    class reader;
+
+    // a reader's view of one generation, valid until the guard goes out of scope
+    class guard
+    {
+    private:
+        friend class reader;
+        std::atomic<uint64_t> *slot_;
+        const Filter *filter_;
+
+        guard(std::atomic<uint64_t> *slot, const Filter *filter) : slot_(slot), filter_(filter) {}
+
+    public:
+        guard(guard &&other) noexcept : slot_(other.slot_), filter_(other.filter_) { other.slot_ = nullptr; }
+        guard(const guard &) = delete;
+        guard &operator=(const guard &) = delete;
+
+        ~guard()
+        {
+            if (slot_)
+                slot_->store(0, std::memory_order_release);
+        }
+
+        const Filter *get() const { return filter_; }
+        const Filter *operator->() const { return filter_; }
+        const Filter &operator*() const { return *filter_; }
+    };
+
+    // a reading thread's registration with the manager, made once per thread (lock free) and kept
+    // for as many reads as it likes. A reader holds at most one guard at a time
+    class reader
+    {
+    private:
+        generation_manager &gm_;
+        size_t slot_;
+
+    public:
+        explicit reader(generation_manager &gm) : gm_(gm), slot_(gm.acquire_slot()) {}
+        ~reader() { gm_.release_slot(slot_); }
+
+        reader(const reader &) = delete;
+        reader &operator=(const reader &) = delete;
+
+        guard read()
+        {
+            std::atomic<uint64_t> &e = gm_.slots_[slot_].epoch;
+            // announce the epoch before loading the generation (both seq_cst): a writer that swapped
+            // the generation out afterwards either sees this epoch or this load returns the new one
+            e.store(gm_.epoch_.load());
+            return guard(&e, gm_.current_.load());
+        }
+    };
+
+    explicit generation_manager(Filter *initial = nullptr) : current_(initial), epoch_(1), generation_(initial ? 1 : 0)
+    {
+        for (size_t i = 0; i < MAX_READERS; i++)
+        {
+            slots_[i].epoch.store(0);
+            slots_[i].used.store(false);
+        }
+    }
+
+    // no reader may be left
+    ~generation_manager()
+    {
+        for (auto &r : retired_)
+            delete r.filter;
+        delete current_.load();
+    }
+
+    generation_manager(const generation_manager &) = delete;
+    generation_manager &operator=(const generation_manager &) = delete;
+
+    // makes next the current generation for all reads that start from now on, readers still on the
+    // previous one keep it until they are done. Returns the new generation number
+    uint64_t publish(Filter *next)
+    {
+        std::lock_guard<std::mutex> lock(writer_mutex_);
+        Filter *old = current_.exchange(next);
+        // readers that loaded old announced an epoch <= the one ending here
+        uint64_t e = epoch_.fetch_add(1);
+        if (old)
+            retired_.push_back(retired{old, e});
+        reclaim_locked();
+        return generation_.fetch_add(1) + 1;
+    }
+
+    // deletes every retired generation no reader can hold anymore, returns how many are left
+    size_t reclaim()
+    {
+        std::lock_guard<std::mutex> lock(writer_mutex_);
+        return reclaim_locked();
+    }
+
+    // waits until all retired generations are deleted
+    void drain()
+    {
+        while (reclaim() > 0)
+            std::this_thread::yield();
+    }
+
+    uint64_t generation() const { return generation_.load(); }
+};
+
+#endif // GENERATION_HH
@@ -0,0 +1,347 @@
+#ifndef KEY_SET_HH
+#define KEY_SET_HH
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "keysource.hh"
+
+/*
+idea: a key set (revoked R, unrevoked S, or a run of random_gen keys) converted once into a binary
+file that every experiment or rebuild maps back in milliseconds, instead of parsing the text lists or
+regenerating the keys each run. Keys are little-endian u64, either raw, so the builders read them in
+place from the mapping, or sorted and stored as LEB128 varints of the gaps between them, which
+roughly halves dense sets and is decoded in chunks through key_source
+*/
+
+enum keyset_flags
+{
+    keyset_sorted = 1, // keys in ascending order
+    keyset_varint = 2, // gaps between sorted keys as varints instead of raw keys
+};
+
+//   keyset_header (little-endian fields), provenance text, payload at payload_offset (page aligned)
+struct keyset_header
+{
+    char magic[8];           // "VPKEYSET"
+    uint32_t version;
+    uint32_t flags;          // keyset_flags
+    uint64_t count;          // keys in the set
+    uint64_t payload_offset;
+    uint64_t payload_bytes;
+    uint64_t created;        // unix time the file was written
+    uint64_t min_key, max_key;
+    uint32_t provenance_bytes; // text right after the header: where the keys came from
+    uint32_t reserved;
+};
+
+static_assert(sizeof(keyset_header) == 72, "keyset_header is written as is");
+
+namespace keyset_detail
+{
+    const char magic[8] = {'V', 'P', 'K', 'E', 'Y', 'S', 'E', 'T'};
+    const uint32_t version = 1;
+    const size_t page = 4096;
+
+    inline uint64_t le64(uint64_t x)
+    {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        return __builtin_bswap64(x);
+#else
+        return x;
+#endif
+    }
+
+    inline uint32_t le32(uint32_t x)
+    {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        return __builtin_bswap32(x);
+#else
+        return x;
+#endif
+    }
+
+    // header fields to and from host order, the magic is left alone
+    inline keyset_header swap(keyset_header h)
+    {
+        h.version = le32(h.version);
+        h.flags = le32(h.flags);
+        h.provenance_bytes = le32(h.provenance_bytes);
+        h.reserved = le32(h.reserved);
+        for (uint64_t *f : {&h.count, &h.payload_offset, &h.payload_bytes, &h.created, &h.min_key, &h.max_key})
+            *f = le64(*f);
+        return h;
+    }
+
+    inline void put_varint(std::vector<uint8_t> &out, uint64_t x)
+    {
+        while (x >= 0x80)
+        {
+            out.push_back(uint8_t(x) | 0x80);
+            x >>= 7;
+        }
+        out.push_back(uint8_t(x));
+    }
+
+    // decodes up to n keys from [p, end) continuing after prev, returns how many. p and prev move on
+    inline size_t get_varints(const uint8_t *&p, const uint8_t *end, uint64_t &prev, uint64_t *out, size_t n)
+    {
+        size_t k = 0;
+        for (; k < n && p < end; k++)
+        {
+            uint64_t x = 0;
+            for (int shift = 0;; shift += 7)
+            {
+                if (p == end || shift > 63)
+                    throw std::runtime_error("key set: bad varint");
+                const uint8_t b = *p++;
+                x |= uint64_t(b & 0x7f) << shift;
+                if (!(b & 0x80))
+                    break;
+            }
+            prev += x;
+            out[k] = prev;
+        }
+        return k;
+    }
+}
+
+// writes n keys to path as a key set (flags: keyset_sorted, and keyset_varint, which implies sorted).
+// The file always reaches payload_offset + payload_bytes, an empty set included, and is synced
+// before the rename.
+// The file is written next to path and renamed over it when complete. Throws std::runtime_error
+// on I/O errors
+inline void write_keyset(const std::string &path, const uint64_t *keys, size_t n, unsigned flags, const std::string &provenance)
+{
+    using namespace keyset_detail;
+    if (flags & keyset_varint)
+        flags |= keyset_sorted;
+
+    std::vector<uint64_t> sorted;
+    if (flags & keyset_sorted)
+    {
+        sorted.assign(keys, keys + n);
+        std::sort(sorted.begin(), sorted.end());
+        keys = sorted.data();
+    }
+
+    std::vector<uint8_t> payload;
+    if (flags & keyset_varint)
+    {
+        payload.reserve(n * 5);
+        uint64_t prev = 0;
+        for (size_t i = 0; i < n; i++)
+        {
+            put_varint(payload, keys[i] - prev);
+            prev = keys[i];
+        }
+    }
+    else
+    {
+        payload.resize(n * sizeof(uint64_t));
+        for (size_t i = 0; i < n; i++)
+        {
+            uint64_t x = le64(keys[i]);
+            memcpy(&payload[i * sizeof(uint64_t)], &x, sizeof(x));
+        }
+    }
+
+    keyset_header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, magic, sizeof(magic));
+    h.version = version;
+    h.flags = flags;
+    h.count = n;
+    h.provenance_bytes = provenance.size();
+    h.payload_offset = (sizeof(h) + provenance.size() + page - 1) / page * page;
+    h.payload_bytes = payload.size();
+    h.created = time(nullptr);
+    h.min_key = n ? *std::min_element(keys, keys + n) : 0;
+    h.max_key = n ? *std::max_element(keys, keys + n) : 0;
+    const keyset_header disk = swap(h);
+
+    const std::string tmp = path + ".tmp";
+    FILE *f = fopen(tmp.c_str(), "wb");
+    if (!f)
+        throw std::runtime_error("could not create key set " + tmp);
+    bool ok = fwrite(&disk, sizeof(disk), 1, f) == 1 &&
+              fwrite(provenance.data(), 1, provenance.size(), f) == provenance.size() &&
+              fseeko(f, h.payload_offset, SEEK_SET) == 0 &&
+              fwrite(payload.data(), 1, payload.size(), f) == payload.size();
+    // a seek alone does not make the file longer, an empty payload would leave it short of payload_offset
+    ok = ok && fflush(f) == 0 && ftruncate(fileno(f), h.payload_offset + h.payload_bytes) == 0 && fsync(fileno(f)) == 0;
+    ok = fclose(f) == 0 && ok;
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0)
+    {
+        unlink(tmp.c_str());
+        throw std::runtime_error("could not write key set " + path);
+    }
+}
+
+// a key set file mapped read-only. Raw keys are used in place (data()), varint ones are decoded
+// on demand (read_all(), keyset_source)
+class keyset
+{
+private:
+    void *map_;
+    size_t size_;
+    keyset_header h_;
+    std::vector<uint64_t> swapped_; // raw keys in host order on a big-endian host
+
+public:
+    explicit keyset(const std::string &path) : map_(nullptr), size_(0)
+    {
+        using namespace keyset_detail;
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw std::runtime_error("could not open key set " + path);
+        struct stat st;
+        if (fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(keyset_header))
+        {
+            close(fd);
+            throw std::runtime_error("not a key set: " + path);
+        }
+        size_ = st.st_size;
+        void *p = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (p == MAP_FAILED)
+            throw std::runtime_error("could not map key set " + path);
+        map_ = p;
+
+        h_ = swap(*static_cast<const keyset_header *>(map_));
+        const uint64_t key_bytes = h_.flags & keyset_varint ? 1 : sizeof(uint64_t);
+        if (memcmp(h_.magic, magic, sizeof(magic)) != 0 || h_.version != version ||
+            sizeof(keyset_header) + h_.provenance_bytes > h_.payload_offset || h_.payload_offset % page ||
+            h_.payload_offset > size_ || h_.payload_bytes > size_ - h_.payload_offset ||
+            h_.count > h_.payload_bytes / key_bytes || (!(h_.flags & keyset_varint) && h_.payload_bytes != h_.count * key_bytes))
+        {
+            munmap(map_, size_);
+            throw std::runtime_error("not a key set or corrupt: " + path);
+        }
+        madvise(map_, size_, MADV_SEQUENTIAL);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        if (!compressed())
+        {
+            swapped_.resize(h_.count);
+            for (size_t i = 0; i < h_.count; i++)
+                swapped_[i] = le64(payload<uint64_t>()[i]);
+        }
+#endif
+    }
+
+    ~keyset() { munmap(map_, size_); }
+
+    keyset(const keyset &) = delete;
+    keyset &operator=(const keyset &) = delete;
+
+    template <typename T>
+    const T *payload() const { return reinterpret_cast<const T *>(static_cast<const char *>(map_) + h_.payload_offset); }
+
+    size_t size() const { return h_.count; }
+    unsigned flags() const { return h_.flags; }
+    bool sorted() const { return h_.flags & keyset_sorted; }
+    bool compressed() const { return h_.flags & keyset_varint; }
+    const keyset_header &header() const { return h_; }
+    size_t payload_bytes() const { return h_.payload_bytes; }
+
+    std::string provenance() const
+    {
+        return std::string(static_cast<const char *>(map_) + sizeof(keyset_header), h_.provenance_bytes);
+    }
+
+    // the keys in place, nullptr for a compressed set
+    const uint64_t *data() const
+    {
+        if (compressed())
+            return nullptr;
+        return swapped_.empty() ? payload<uint64_t>() : swapped_.data();
+    }
+
+    // appends all keys to out, converted to KeyType
+    template <typename KeyType>
+    void read_all(std::vector<KeyType> &out) const
+    {
+        const size_t old = out.size();
+        out.resize(old + size());
+        if (!compressed())
+        {
+            std::copy(data(), data() + size(), out.begin() + old);
+            return;
+        }
+        const uint8_t *p = payload<uint8_t>();
+        uint64_t prev = 0;
+        std::vector<uint64_t> buf(std::min<size_t>(size(), 1 << 16));
+        for (size_t i = old, k; i < out.size(); i += k)
+        {
+            k = keyset_detail::get_varints(p, payload<uint8_t>() + payload_bytes(), prev, buf.data(), std::min(buf.size(), out.size() - i));
+            if (k == 0)
+                throw std::runtime_error("key set: fewer keys than its header says");
+            std::copy(buf.begin(), buf.begin() + k, out.begin() + i);
+        }
+    }
+};
+
+// a key set as a key_source: raw keys in one chunk straight from the mapping, compressed ones
+// decoded chunk_size keys at a time. Like read_all, throws std::runtime_error when a compressed
+// payload ends before the header's count of keys
+template <typename KeyType = uint64_t>
+class keyset_source : public key_source<KeyType>
+{
+    static_assert(std::is_integral<KeyType>::value && sizeof(KeyType) == sizeof(uint64_t), "key sets hold 64-bit keys");
+
+private:
+    const keyset &set_;
+    std::vector<KeyType> buf_;
+    const uint8_t *pos_;
+    uint64_t prev_;
+    size_t done_;
+
+public:
+    explicit keyset_source(const keyset &set, size_t chunk_size = 1 << 20)
+        : set_(set), buf_(set.compressed() ? chunk_size : 0), pos_(nullptr), prev_(0), done_(0)
+    {
+        rewind();
+    }
+
+    void rewind()
+    {
+        pos_ = set_.payload<uint8_t>();
+        prev_ = 0;
+        done_ = 0;
+    }
+
+    size_t next(const KeyType *&chunk)
+    {
+        size_t n;
+        if (!set_.compressed())
+        {
+            chunk = reinterpret_cast<const KeyType *>(set_.data());
+            n = set_.size() - done_;
+        }
+        else
+        {
+            chunk = buf_.data();
+            const size_t want = std::min(buf_.size(), set_.size() - done_);
+            n = keyset_detail::get_varints(pos_, set_.payload<uint8_t>() + set_.payload_bytes(), prev_,
+                                           reinterpret_cast<uint64_t *>(buf_.data()), want);
+            if (n < want)
+                throw std::runtime_error("key set: fewer keys than its header says");
+        }
+        done_ += n;
+        return n;
+    }
+};
+
+#endif // KEY_SET_HH
@@ -0,0 +1,116 @@
+#ifndef KEY_SOURCE_HH
+#define KEY_SOURCE_HH
+
+#include <cstdio>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/*
+idea: chunked sources of keys for building a vacuum pair, so the set of unrevoked keys S
+can be re-read once per lookup round instead of held in memory for the whole build
+*/
+
+template <typename KeyType>
+class key_source
+{
+public:
+    virtual ~key_source() {}
+
+    // restarts from the first key, called at the start of every pass over the keys
+    virtual void rewind() = 0;
+
+    // points chunk at the next keys and returns how many there are, 0 once all keys were read.
+    // chunk stays valid until the following call to next() or rewind()
+    virtual size_t next(const KeyType *&chunk) = 0;
+};
+
+// keys already in memory, handed out as a single chunk without copying
+template <typename KeyType>
+class array_key_source : public key_source<KeyType>
+{
+private:
+    const KeyType *keys_;
+    size_t size_;
+    bool done_;
+
+public:
+    array_key_source(const KeyType *keys, size_t size) : keys_(keys), size_(size), done_(false) {}
+
+    void rewind() { done_ = false; }
+
+    size_t next(const KeyType *&chunk)
+    {
+        if (done_)
+            return 0;
+        done_ = true;
+        chunk = keys_;
+        return size_;
+    }
+};
+
+// binary file of raw keys (native byte order, no header), read chunk_size keys at a time. Throws
+// std::runtime_error on a read error or a file that ends in the middle of a key, rather than
+// handing out a truncated key set
+template <typename KeyType>
+class file_key_source : public key_source<KeyType>
+{
+private:
+    std::string filename_;
+    FILE *file_;
+    std::vector<KeyType> buf_;
+
+public:
+    explicit file_key_source(const std::string &filename, size_t chunk_size = 1 << 20) : filename_(filename), buf_(chunk_size)
+    {
+        file_ = fopen(filename.c_str(), "rb");
+        if (file_ == NULL)
+            throw std::runtime_error("could not open key file " + filename);
+    }
+
+    ~file_key_source() { fclose(file_); }
+
+    file_key_source(const file_key_source &) = delete;
+    file_key_source &operator=(const file_key_source &) = delete;
+
+    void rewind() { ::rewind(file_); }
+
+    size_t next(const KeyType *&chunk)
+    {
+        chunk = buf_.data();
+        // bytes rather than keys, so a partial key at the end shows
+        const size_t want = buf_.size() * sizeof(KeyType);
+        const size_t got = fread(buf_.data(), 1, want, file_);
+        if (got < want && ferror(file_))
+            throw std::runtime_error("could not read key file " + filename_);
+        if (got % sizeof(KeyType))
+            throw std::runtime_error("key file " + filename_ + " ends in a partial key");
+        return got / sizeof(KeyType);
+    }
+};
+
+// keys produced by a callback filling up to n keys into buf and returning how many it wrote
+// (0 once done); reset is called before every pass to restart the sequence
+template <typename KeyType>
+class callback_key_source : public key_source<KeyType>
+{
+private:
+    std::function<size_t(KeyType *, size_t)> fill_;
+    std::function<void()> reset_;
+    std::vector<KeyType> buf_;
+
+public:
+    callback_key_source(std::function<size_t(KeyType *, size_t)> fill, std::function<void()> reset, size_t chunk_size = 1 << 20)
+        : fill_(fill), reset_(reset), buf_(chunk_size) {}
+
+    void rewind() { reset_(); }
+
+    size_t next(const KeyType *&chunk)
+    {
+        chunk = buf_.data();
+        return fill_(buf_.data(), buf_.size());
+    }
+};
+
+#endif // KEY_SOURCE_HH
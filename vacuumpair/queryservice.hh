@@ -0,0 +1,246 @@
+#ifndef QUERY_SERVICE_HH
+#define QUERY_SERVICE_HH
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <dirent.h>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+idea: read-only lookups of a built filter (VacuumFilter, BFCascade, ...) from a pool of pinned worker
+threads, so a large batch of revocation checks is spread over all cores. With replicas, every NUMA node
+gets its own copy of the filter, so lookups never cross the interconnect
+*/
+
+// cpus this process may run on, grouped by NUMA node (from /sys/devices/system/node, a single node when
+// that is not there)
+struct numa_topology
+{
+    std::vector<std::vector<int>> node_cpus;
+
+    size_t num_nodes() const { return node_cpus.size(); }
+
+    size_t num_cpus() const
+    {
+        size_t n = 0;
+        for (auto &cpus : node_cpus)
+            n += cpus.size();
+        return n;
+    }
+
+    // cpu list format of sysfs, e.g. "0-3,8-11"
+    static std::vector<int> parse_cpulist(const std::string &list)
+    {
+        std::vector<int> cpus;
+        std::stringstream ss(list);
+        std::string range;
+        while (std::getline(ss, range, ','))
+        {
+            if (range.empty() || range == "\n")
+                continue;
+            size_t dash = range.find('-');
+            int lo = std::stoi(range.substr(0, dash));
+            int hi = dash == std::string::npos ? lo : std::stoi(range.substr(dash + 1));
+            for (int c = lo; c <= hi; c++)
+                cpus.push_back(c);
+        }
+        return cpus;
+    }
+
+    static numa_topology detect()
+    {
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        bool have_mask = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+
+        numa_topology topo;
+        std::vector<int> nodes;
+        if (DIR *dir = opendir("/sys/devices/system/node"))
+        {
+            while (struct dirent *e = readdir(dir))
+            {
+                int node;
+                if (sscanf(e->d_name, "node%d", &node) == 1)
+                    nodes.push_back(node);
+            }
+            closedir(dir);
+        }
+        std::sort(nodes.begin(), nodes.end());
+        for (int node : nodes)
+        {
+            std::ifstream in("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+            std::string list;
+            std::getline(in, list);
+            std::vector<int> cpus;
+            for (int c : parse_cpulist(list))
+                if (!have_mask || CPU_ISSET(c, &allowed))
+                    cpus.push_back(c);
+            if (!cpus.empty())
+                topo.node_cpus.push_back(cpus);
+        }
+        if (topo.node_cpus.empty())
+        {
+            std::vector<int> cpus;
+            for (int c = 0; c < CPU_SETSIZE; c++)
+                if (have_mask ? CPU_ISSET(c, &allowed) : c < (int)std::max(1u, std::thread::hardware_concurrency()))
+                    cpus.push_back(c);
+            topo.node_cpus.push_back(cpus);
+        }
+        return topo;
+    }
+};
+
+// Filter has to be copy constructible (a deep copy) when replicas are used
+template <typename Filter, typename KeyType = uint64_t>
+class query_service
+{
+public:
+    // looks up n keys in one copy of the filter, result[i] = keys[i] found, e.g. a call to
+    // VacuumFilter::Contain_many or a loop over BFCascade::lookup
+    using lookup_fn = std::function<void(const Filter &, const KeyType *, size_t, bool *)>;
+
+private:
+    const Filter &filter_;
+    lookup_fn lookup_;
+    size_t chunk_;
+    numa_topology topo_;
+
+    std::vector<std::thread> workers_;
+    std::vector<std::unique_ptr<Filter>> replicas_; // one per NUMA node used, empty without replicas
+    std::vector<const Filter *> node_filter_;       // filter the workers of each node read
+
+    // current batch, handed to the workers by bumping generation_
+    std::mutex mutex_;
+    std::condition_variable work_cv_, done_cv_;
+    size_t generation_;
+    size_t running_;   // workers still busy with the current batch, or not set up yet
+    bool stop_;
+    const KeyType *keys_;
+    bool *result_;
+    size_t n_;
+    std::atomic<size_t> next_; // first key of the next chunk to take
+
+    void pin(int cpu)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+
+    void worker(int cpu, size_t node, bool build_replica)
+    {
+        pin(cpu);
+        if (build_replica)
+        {
+            // copied by a thread of the node itself, so the kernel's first-touch policy allocates the
+            // replica in that node's memory
+            replicas_[node].reset(new Filter(filter_));
+            node_filter_[node] = replicas_[node].get();
+        }
+        size_t seen = 0;
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (--running_ == 0)
+            done_cv_.notify_all();
+        while (true)
+        {
+            work_cv_.wait(lock, [&] { return stop_ || generation_ != seen; });
+            if (stop_)
+                return;
+            seen = generation_;
+            const Filter &f = *node_filter_[node];
+            lock.unlock();
+
+            for (size_t begin; (begin = next_.fetch_add(chunk_)) < n_;)
+                lookup_(f, keys_ + begin, std::min(chunk_, n_ - begin), result_ + begin);
+
+            lock.lock();
+            if (--running_ == 0)
+                done_cv_.notify_all();
+        }
+    }
+
+public:
+    // num_threads workers (0 = one per cpu) pinned to cpus node by node, so a few threads share one
+    // node. filter stays owned by the caller; with replicate every node that has workers gets its own
+    // copy instead, built before the constructor returns. chunk is the number of keys a worker takes at once
+    query_service(const Filter &filter, lookup_fn lookup, size_t num_threads = 0, bool replicate = false, size_t chunk = 4096)
+        : filter_(filter), lookup_(lookup), chunk_(std::max<size_t>(1, chunk)), topo_(numa_topology::detect()),
+          generation_(0), running_(0), stop_(false), keys_(nullptr), result_(nullptr), n_(0), next_(0)
+    {
+        std::vector<std::pair<int, size_t>> slots; // (cpu, node), node-major
+        for (size_t node = 0; node < topo_.num_nodes(); node++)
+            for (int cpu : topo_.node_cpus[node])
+                slots.push_back(std::make_pair(cpu, node));
+        if (num_threads == 0)
+            num_threads = slots.size();
+
+        node_filter_.assign(topo_.num_nodes(), &filter_);
+        replicas_.resize(topo_.num_nodes());
+        std::vector<bool> has_builder(topo_.num_nodes(), false);
+
+        running_ = num_threads;
+        for (size_t t = 0; t < num_threads; t++)
+        {
+            // more threads than cpus wrap around
+            const std::pair<int, size_t> &slot = slots[t % slots.size()];
+            bool build = replicate && !has_builder[slot.second];
+            has_builder[slot.second] = true;
+            workers_.push_back(std::thread(&query_service::worker, this, slot.first, slot.second, build));
+        }
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_cv_.wait(lock, [&] { return running_ == 0; });
+    }
+
+    ~query_service()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        work_cv_.notify_all();
+        for (auto &w : workers_)
+            w.join();
+    }
+
+    query_service(const query_service &) = delete;
+    query_service &operator=(const query_service &) = delete;
+
+    // result[i] = lookup of keys[i], returns once the whole batch is done. Not reentrant: one batch at a time
+    void lookup_many(const KeyType *keys, size_t n, bool *result)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        keys_ = keys;
+        result_ = result;
+        n_ = n;
+        next_.store(0);
+        running_ = workers_.size();
+        generation_++;
+        work_cv_.notify_all();
+        done_cv_.wait(lock, [&] { return running_ == 0; });
+    }
+
+    size_t num_threads() const { return workers_.size(); }
+
+    size_t num_nodes() const { return topo_.num_nodes(); }
+
+    size_t num_replicas() const
+    {
+        return std::count_if(replicas_.begin(), replicas_.end(), [](const std::unique_ptr<Filter> &r) { return r != nullptr; });
+    }
+};
+
+#endif // QUERY_SERVICE_HH
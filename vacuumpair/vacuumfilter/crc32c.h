@@ -0,0 +1,153 @@
+#ifndef CUCKOO_FILTER_CRC32C_H_
+#define CUCKOO_FILTER_CRC32C_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#ifdef __SSE4_2__
+#include <nmmintrin.h>
+#endif
+
+namespace cuckoofilter {
+
+// CRC-32C (Castagnoli), the checksum of iSCSI and ext4, with the crc32
+// instruction of SSE4.2 when the build targets it (-msse4.2, -march=native)
+// and a table otherwise. The instruction has a latency of 3 cycles but
+// issues every cycle, so large buffers are done as three interleaved
+// streams whose CRCs are combined at the end, and Crc32cRanges splits the
+// work into chunks across threads, combining the chunk CRCs the same way.
+const uint32_t kCrc32cPoly = 0x82f63b78;  // reflected
+const size_t kCrcLane = 8192;             // bytes per stream of an interleaved block
+const size_t kCrcChunk = 1 << 20;         // bytes per thread work item
+
+namespace crc32c_internal {
+
+// a * b modulo the polynomial, both reflected (x^0 in the top bit)
+inline uint32_t MultModP(uint32_t a, uint32_t b) {
+  uint32_t m = 1u << 31, p = 0;
+  for (;;) {
+    if (a & m) {
+      p ^= b;
+      if ((a & (m - 1)) == 0) break;
+    }
+    m >>= 1;
+    b = b & 1 ? (b >> 1) ^ kCrc32cPoly : b >> 1;
+  }
+  return p;
+}
+
+// x^(8 * bytes) modulo the polynomial: what appending bytes zero bytes
+// multiplies a CRC by
+inline uint32_t ShiftBytes(uint64_t bytes) {
+  uint32_t p = 1u << 31;   // x^0
+  uint32_t x2k = 1u << 23; // x^8, squared each bit of bytes
+  for (; bytes; bytes >>= 1) {
+    if (bytes & 1) p = MultModP(x2k, p);
+    x2k = MultModP(x2k, x2k);
+  }
+  return p;
+}
+
+inline const uint32_t *Table() {
+  static const struct T {
+    uint32_t t[256];
+    T() {
+      for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) c = c & 1 ? (c >> 1) ^ kCrc32cPoly : c >> 1;
+        t[i] = c;
+      }
+    }
+  } table;
+  return table.t;
+}
+
+// raw register (no inversion) over n bytes
+inline uint32_t Update(uint32_t r, const uint8_t *p, size_t n) {
+#ifdef __SSE4_2__
+  uint64_t r64 = r;
+  for (; n >= 8; n -= 8, p += 8) {
+    uint64_t w;
+    memcpy(&w, p, 8);
+    r64 = _mm_crc32_u64(r64, w);
+  }
+  r = (uint32_t)r64;
+  for (; n; n--) r = _mm_crc32_u8(r, *p++);
+#else
+  const uint32_t *t = Table();
+  for (; n; n--) r = t[(r ^ *p++) & 0xff] ^ (r >> 8);
+#endif
+  return r;
+}
+}  // namespace crc32c_internal
+
+// CRC of a followed by b, from the CRCs of both and the length of b
+inline uint32_t Crc32cCombine(uint32_t crc_a, uint32_t crc_b, uint64_t bytes_b) {
+  return crc32c_internal::MultModP(crc32c_internal::ShiftBytes(bytes_b), crc_a) ^ crc_b;
+}
+
+// CRC of the bytes before (crc, 0 to start) followed by the n bytes at data
+inline uint32_t Crc32cExtend(uint32_t crc, const void *data, size_t n) {
+  using namespace crc32c_internal;
+  const uint8_t *p = static_cast<const uint8_t *>(data);
+#ifdef __SSE4_2__
+  if (n >= 3 * kCrcLane) {
+    static const uint32_t shift = ShiftBytes(kCrcLane);
+    for (; n >= 3 * kCrcLane; n -= 3 * kCrcLane, p += 3 * kCrcLane) {
+      uint64_t r0 = ~crc, r1 = ~0u, r2 = ~0u;
+      for (size_t i = 0; i < kCrcLane; i += 8) {
+        uint64_t w0, w1, w2;
+        memcpy(&w0, p + i, 8);
+        memcpy(&w1, p + kCrcLane + i, 8);
+        memcpy(&w2, p + 2 * kCrcLane + i, 8);
+        r0 = _mm_crc32_u64(r0, w0);
+        r1 = _mm_crc32_u64(r1, w1);
+        r2 = _mm_crc32_u64(r2, w2);
+      }
+      crc = MultModP(shift, ~(uint32_t)r0) ^ ~(uint32_t)r1;
+      crc = MultModP(shift, crc) ^ ~(uint32_t)r2;
+    }
+  }
+#endif
+  return ~Update(~crc, p, n);
+}
+
+inline uint32_t Crc32c(const void *data, size_t n) { return Crc32cExtend(0, data, n); }
+
+// crcs[i] = Crc32c(data[i], bytes[i]) for n ranges, the ranges cut into
+// kCrcChunk byte chunks that up to threads threads (0: one per core) take in
+// turn, so one big range keeps every core busy as well as many small ones
+inline void Crc32cRanges(const void *const *data, const size_t *bytes, const size_t n, uint32_t *crcs,
+                         unsigned threads = 0) {
+  struct Chunk {
+    size_t range, offset, bytes;
+    uint32_t crc;
+  };
+  std::vector<Chunk> chunks;
+  for (size_t i = 0; i < n; i++)
+    for (size_t off = 0; off < bytes[i]; off += kCrcChunk)
+      chunks.push_back(Chunk{i, off, std::min(kCrcChunk, bytes[i] - off), 0});
+
+  std::atomic<size_t> next(0);
+  auto work = [&]() {
+    for (size_t c; (c = next++) < chunks.size();)
+      chunks[c].crc = Crc32c(static_cast<const char *>(data[chunks[c].range]) + chunks[c].offset, chunks[c].bytes);
+  };
+  if (!threads) threads = std::max(1u, std::thread::hardware_concurrency());
+  threads = std::min<size_t>(threads, chunks.size());
+  std::vector<std::thread> pool;
+  for (unsigned t = 1; t < threads; t++) pool.emplace_back(work);
+  work();
+  for (auto &t : pool) t.join();
+
+  std::fill(crcs, crcs + n, 0);
+  for (const Chunk &c : chunks) crcs[c.range] = c.offset ? Crc32cCombine(crcs[c.range], c.crc, c.bytes) : c.crc;
+}
+}  // namespace cuckoofilter
+
+#endif  // CUCKOO_FILTER_CRC32C_H_
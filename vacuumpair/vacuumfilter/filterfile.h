@@ -0,0 +1,352 @@
+#ifndef CUCKOO_FILTER_FILTER_FILE_H_
+#define CUCKOO_FILTER_FILTER_FILE_H_
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <typeinfo>
+
+#include "crc32c.h"
+
+namespace cuckoofilter {
+
+// Binary file of a built VacuumFilter (VacuumFilter::Save, VacuumFilter::Map):
+//   FileHeader, then the sections listed in FileHeader::sections, each one
+//   starting at a multiple of kFileAlign:
+//     kSectionTable          bucket array of the table, padding buckets included
+//     kSectionTableOverflow  (bucket, seed) uint32 pairs of a SeededTable
+//     kSectionSeeds          words of the seed table (SeedTable or
+//                            SparseSeedTable, told apart by seeds_id)
+//     kSectionSeedOverflow   (bucket, seed) uint32 pairs of the seed table
+//     kSectionHash           parameters of the hash function (HashParamBytes),
+//                            empty for a stateless one
+// A section may be empty (bytes = 0). Integers are in host byte order, a file
+// written on a machine of the other byte order is rejected. The table and the
+// seeds are used in place from a read-only mapping of the file, so opening a
+// filter costs one page fault per page a lookup touches instead of a rebuild.
+// Every section carries the CRC-32C (crc32c.h) of its bytes and the header
+// one of itself (header_crc taken as 0), which MappedFile::Verify checks
+// before a mapped filter is handed out, reading the file once.
+//
+// Patch from one filter file to the next (VacuumFilter::Diff, ApplyPatch), for
+// two generations built with the same geometry (same capacity, so same bucket
+// count and alt ranges):
+//   PatchHeader, the new overflow seeds of the table and of the seed table
+//   (replaced whole, they are few), then one run per changed stretch of the
+//   table and the seed words, which are taken as one byte array (table
+//   first): varint gap from the end of the previous run, varint length, the
+//   new bytes. Runs are found 8 bytes at a time and joined across gaps of
+//   less than kPatchJoin bytes. A SparseSeedTable changes size with the
+//   number of rehashed buckets, two of different size get no patch.
+//
+// Compressed filter for transport (VacuumFilter::SaveCompressed,
+// LoadCompressed):
+//   CompressedHeader, the parameters of the hash function, then one range
+//   coded stream (rangecoder.h) of the buckets in order: the bucket's seed
+//   (whether it is 0, in the context of the previous bucket's; else seed - 1
+//   as 4 modelled bits, 15 escaping to 32 direct bits), then each slot
+//   (whether it is empty, in the context of the slot index and of the slot
+//   before; else the tag as direct bits). Tags are hash bits and do not
+//   compress, what is saved are the empty slots and the zero seeds. The
+//   decoder writes every bucket straight into a newly allocated table.
+const char kFileMagic[8] = {'V', 'A', 'C', 'F', 'L', 'T', 'R', '\0'};
+const uint32_t kFileVersion = 3;  // 2: section and header CRCs, 3: hash parameters
+const uint32_t kByteOrderMark = 0x01020304;
+const size_t kFileAlign = 4096;
+const size_t kFileMaxAR = 8;
+
+enum FileSection {
+  kSectionTable = 0,
+  kSectionTableOverflow,
+  kSectionSeeds,
+  kSectionSeedOverflow,
+  kSectionHash,
+  kNumSections,
+};
+
+struct FileSectionEntry {
+  uint64_t offset;  // from the start of the file
+  uint64_t bytes;
+  uint32_t crc;     // Crc32c of the bytes
+  uint32_t reserved;
+};
+
+struct FileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;      // kByteOrderMark as written
+  uint32_t header_bytes;    // sizeof(FileHeader)
+  uint32_t key_bytes;       // sizeof(ItemType)
+  uint32_t bits_per_item;
+  uint32_t table_id;        // TableType::kTableId
+  uint32_t seeds_id;        // SeedsType::kSeedsId, 0 when the table keeps the seeds
+  uint32_t hash_bytes;      // HashParamBytes<HashFamily>()
+  uint64_t num_buckets;
+  uint64_t num_items;
+  uint32_t ar;              // alt ranges used in len
+  int32_t len[kFileMaxAR];  // alt range masks of AltIndex, unused ones 0
+  int32_t big_seg;
+  int32_t nonzero_alt;
+  uint32_t alt_multiplier;  // multiplier of AltIndex
+  uint32_t packed;
+  uint32_t hash_id;         // FileTypeId of HashFamily
+  uint32_t header_crc;      // Crc32c of the header with this field 0
+  uint32_t reserved;
+  FileSectionEntry sections[kNumSections];
+};
+
+static_assert(std::is_standard_layout<FileHeader>::value && sizeof(FileHeader) == 240,
+              "FileHeader is written as is and must not change by accident");
+
+const char kPatchMagic[8] = {'V', 'A', 'C', 'P', 'A', 'T', 'C', 'H'};
+const uint32_t kPatchVersion = 1;
+const size_t kPatchJoin = 16;
+
+struct PatchHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint32_t header_bytes;
+  uint32_t table_id;
+  uint32_t bits_per_item;
+  uint32_t seeds_id;
+  uint64_t num_buckets;
+  uint64_t table_bytes;           // bytes of table the runs may cover, then the seeds
+  uint64_t seed_bytes;
+  uint64_t base_digest;           // FilterDigest of the filter the patch applies to
+  uint64_t target_digest;         // and of the filter it makes
+  uint64_t num_items;             // of the target
+  uint64_t table_overflow;        // overflow pairs of the target table
+  uint64_t seed_overflow;         // overflow pairs of the target seed table
+  uint64_t num_runs;
+  uint64_t run_bytes;             // bytes of the encoded runs
+};
+
+static_assert(std::is_standard_layout<PatchHeader>::value && sizeof(PatchHeader) == 112,
+              "PatchHeader is written as is and must not change by accident");
+
+const char kCompressedMagic[8] = {'V', 'A', 'C', 'F', 'L', 'T', 'Z', '\0'};
+const uint32_t kCompressedVersion = 3;  // 2: FileHeader of version 2, 3: hash parameters
+
+struct CompressedHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint32_t header_bytes;
+  uint32_t slots_per_bucket;
+  FileHeader filter;      // as Save would write it, without offsets: the
+                          // CRCs of the table and the seeds check the decoding
+  uint64_t stream_bytes;  // of the range coded buckets
+  uint64_t raw_bytes;     // table and seeds as Save would write them
+};
+
+static_assert(std::is_standard_layout<CompressedHeader>::value && sizeof(CompressedHeader) == 280,
+              "CompressedHeader is written as is and must not change by accident");
+
+// 64-bit digest of n bytes (multiply and rotate, 8 bytes a step) chained
+// from h, to tell filter contents apart in a patch; not cryptographic
+inline uint64_t DigestBytes(const void *data, size_t n, uint64_t h) {
+  const uint64_t kMul = 0x9e3779b97f4a7c15ULL;
+  const char *p = static_cast<const char *>(data);
+  for (; n >= 8; n -= 8, p += 8) {
+    uint64_t w;
+    memcpy(&w, p, 8);
+    h = ((h ^ w) * kMul);
+    h ^= h >> 29;
+  }
+  uint64_t w = 0;
+  if (n) memcpy(&w, p, n);
+  h = ((h ^ w ^ (uint64_t)n << 56) * kMul);
+  return h ^ (h >> 32);
+}
+
+// FNV-1a of the mangled type name, which is fixed by the Itanium C++ ABI, so
+// a filter is not looked up with another hash function of the same size
+template <typename T>
+uint32_t FileTypeId() {
+  uint32_t h = 2166136261u;
+  for (const char *p = typeid(T).name(); *p; p++) h = (h ^ (unsigned char)*p) * 16777619u;
+  return h;
+}
+
+// bytes a filter file keeps of a hash function, besides its FileTypeId in the
+// header. A stateless one (an empty class such as CityHasher) has nothing to
+// keep: its object is a padding byte of no set value, and writing it would make
+// two saves of the same filter differ. One with state (TwoIndependentMultiplyShift,
+// SimpleTabulation) is kept as its bytes, so its members must be plain integers
+// without padding between them
+template <typename HashFamily>
+size_t HashParamBytes() {
+  static_assert(std::is_trivially_copyable<HashFamily>::value, "hash parameters are saved as bytes");
+  return std::is_empty<HashFamily>::value ? 0 : sizeof(HashFamily);
+}
+
+// whole file mapped read-only, throws std::runtime_error when it cannot be
+// opened. populate: fault every page in up front (MAP_POPULATE). The mapping
+// is private, so MakeWritable lets a patch change it in memory page by page
+// (copy on write) while the file stays as it is
+class MappedFile {
+  void *data_;
+  size_t size_;
+
+ public:
+  explicit MappedFile(const std::string &path, const bool populate = false)
+      : data_(NULL), size_(0) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) throw std::runtime_error("could not open " + path);
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+      close(fd);
+      throw std::runtime_error("could not read " + path);
+    }
+    size_ = st.st_size;
+    int flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+    if (populate) flags |= MAP_POPULATE;
+#endif
+    void *p = mmap(NULL, size_, PROT_READ, flags, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) throw std::runtime_error("could not map " + path);
+    data_ = p;
+    // lookups hit random buckets, read-ahead would only load pages nobody asked for
+    if (!populate) madvise(data_, size_, MADV_RANDOM);
+  }
+
+  ~MappedFile() {
+    if (data_) munmap(data_, size_);
+  }
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  const char *data() const { return static_cast<const char *>(data_); }
+  size_t size() const { return size_; }
+
+  void MakeWritable() {
+    if (mprotect(data_, size_, PROT_READ | PROT_WRITE) != 0)
+      throw std::runtime_error("could not make a mapping writable");
+  }
+
+  // header of a filter file, after checking it is one this code can read and
+  // that all its sections lie inside the file
+  const FileHeader &Header() const {
+    if (size_ < sizeof(FileHeader)) throw std::runtime_error("filter file too short");
+    const FileHeader &h = *reinterpret_cast<const FileHeader *>(data_);
+    if (memcmp(h.magic, kFileMagic, sizeof(kFileMagic)) != 0)
+      throw std::runtime_error("not a filter file");
+    if (h.byte_order != kByteOrderMark)
+      throw std::runtime_error("filter file written with the other byte order");
+    if (h.version != kFileVersion || h.header_bytes != sizeof(FileHeader))
+      throw std::runtime_error("filter file version " + std::to_string(h.version) +
+                               " not supported");
+    for (int s = 0; s < kNumSections; s++) {
+      const FileSectionEntry &e = h.sections[s];
+      if (e.bytes && (e.offset % kFileAlign || e.offset > size_ || e.bytes > size_ - e.offset))
+        throw std::runtime_error("filter file truncated or corrupt");
+    }
+    return h;
+  }
+
+  const void *Section(const int s) const {
+    return data() + Header().sections[s].offset;
+  }
+
+  // checks the CRCs of the header and of every section (as written, before
+  // any patch), reading the whole file once on up to threads threads (0: one
+  // per core). Throws std::runtime_error naming the first part that differs
+  void Verify(const unsigned threads = 0) const {
+    const FileHeader &h = Header();
+    FileHeader zeroed = h;
+    zeroed.header_crc = 0;
+    if (Crc32c(&zeroed, sizeof(zeroed)) != h.header_crc)
+      throw std::runtime_error("filter file header checksum mismatch");
+    const void *data[kNumSections];
+    size_t bytes[kNumSections];
+    uint32_t crcs[kNumSections];
+    for (int s = 0; s < kNumSections; s++) {
+      data[s] = Section(s);
+      bytes[s] = h.sections[s].bytes;
+    }
+    // the mapping is MADV_RANDOM for lookups, read-ahead is what a full pass wants
+    madvise(data_, size_, MADV_SEQUENTIAL);
+    Crc32cRanges(data, bytes, kNumSections, crcs, threads);
+    madvise(data_, size_, MADV_RANDOM);
+    for (int s = 0; s < kNumSections; s++)
+      if (crcs[s] != h.sections[s].crc)
+        throw std::runtime_error("filter file section " + std::to_string(s) + " checksum mismatch");
+  }
+};
+
+// writes a filter file section by section and the header last. The file is
+// written next to path and renamed over it by Finish, so a service mapping
+// path never sees half a filter. Throws std::runtime_error on I/O errors
+class FilterFileWriter {
+  std::string path_, tmp_;
+  FILE *f_;
+  FileHeader header_;
+  uint64_t end_;
+
+  void Write(const void *p, const size_t bytes) {
+    if (bytes && fwrite(p, 1, bytes, f_) != bytes)
+      throw std::runtime_error("could not write filter file " + tmp_);
+  }
+
+ public:
+  // header: everything but magic, version, byte order and the sections
+  FilterFileWriter(const std::string &path, const FileHeader &header)
+      : path_(path), tmp_(path + ".tmp"), f_(NULL), header_(header), end_(kFileAlign) {
+    memcpy(header_.magic, kFileMagic, sizeof(kFileMagic));
+    header_.version = kFileVersion;
+    header_.byte_order = kByteOrderMark;
+    header_.header_bytes = sizeof(FileHeader);
+    memset(header_.sections, 0, sizeof(header_.sections));
+    f_ = fopen(tmp_.c_str(), "wb");
+    if (!f_) throw std::runtime_error("could not create filter file " + tmp_);
+  }
+
+  ~FilterFileWriter() {
+    if (f_) {
+      fclose(f_);
+      unlink(tmp_.c_str());
+    }
+  }
+
+  FilterFileWriter(const FilterFileWriter &) = delete;
+  FilterFileWriter &operator=(const FilterFileWriter &) = delete;
+
+  void AddSection(const int s, const void *p, const size_t bytes) {
+    header_.sections[s].bytes = bytes;
+    Crc32cRanges(&p, &bytes, 1, &header_.sections[s].crc);
+    if (!bytes) return;
+    header_.sections[s].offset = end_;
+    if (fseeko(f_, end_, SEEK_SET) != 0)
+      throw std::runtime_error("could not write filter file " + tmp_);
+    Write(p, bytes);
+    end_ = (end_ + bytes + kFileAlign - 1) / kFileAlign * kFileAlign;
+  }
+
+  void Finish() {
+    if (fseeko(f_, 0, SEEK_SET) != 0) throw std::runtime_error("could not write filter file " + tmp_);
+    header_.header_crc = 0;
+    header_.header_crc = Crc32c(&header_, sizeof(header_));
+    Write(&header_, sizeof(header_));
+    bool ok = fflush(f_) == 0 && fsync(fileno(f_)) == 0;
+    ok = fclose(f_) == 0 && ok;
+    f_ = NULL;
+    if (!ok || rename(tmp_.c_str(), path_.c_str()) != 0) {
+      unlink(tmp_.c_str());
+      throw std::runtime_error("could not write filter file " + path_);
+    }
+  }
+};
+}  // namespace cuckoofilter
+
+#endif  // CUCKOO_FILTER_FILTER_FILE_H_
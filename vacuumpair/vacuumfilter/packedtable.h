@@ -5,6 +5,7 @@
 #include <utility>
 
 #include "debug.h"
+#include "pagealloc.h"
 #include "permencoding.h"
 #include "printutil.h"
 
@@ -22,21 +23,39 @@ class PackedTable {
   size_t len_;
   size_t num_buckets_;
   char *buckets_;
+  PageBuffer mem_;
   PermEncoding perm_;
 
  public:
-  explicit PackedTable(size_t num) : num_buckets_(num) {
-    // NOTE(binfan): use 7 extra bytes to avoid overrun as we
-    // always read a uint64
-    len_ = kBytesPerBucket * num_buckets_ + 7;
-    buckets_ = new char[len_];
-    memset(buckets_, 0, len_); 
+  // seeds are kept by the filter, next to the table
+  static const bool kSeedsInBuckets = false;
+  // table kind in a filter file (filterfile.h)
+  static const uint32_t kTableId = 2;
+
+  // pages: PageFlags for the bucket array
+  explicit PackedTable(size_t num, const int pages = kNormalPages)
+      // NOTE(binfan): use 7 extra bytes to avoid overrun as we
+      // always read a uint64
+      : len_(kBytesPerBucket * num + 7), num_buckets_(num), mem_(len_, pages) {
+    buckets_ = static_cast<char *>(mem_.data());
   }
 
-  ~PackedTable() { 
-    delete[] buckets_; 
+  // read-only table over DataBytes() of buckets kept elsewhere, e.g. in a
+  // mapped filter file; data must outlive the table
+  PackedTable(size_t num, const void *data)
+      : len_(kBytesPerBucket * num + 7), num_buckets_(num) {
+    buckets_ = static_cast<char *>(const_cast<void *>(data));
   }
 
+  // deep copy, in memory allocated with the same PageFlags
+  PackedTable(const PackedTable &other)
+      : len_(other.len_), num_buckets_(other.num_buckets_), mem_(other.len_, other.mem_.flags()), perm_(other.perm_) {
+    buckets_ = static_cast<char *>(mem_.data());
+    memcpy(buckets_, other.buckets_, len_);
+  }
+
+  PackedTable &operator=(const PackedTable &) = delete;
+
   size_t NumBuckets() const {
     return num_buckets_;
   }
@@ -49,6 +68,11 @@ class PackedTable {
     return len_; 
   }
 
+  // the bucket array as stored
+  const void *Data() const { return buckets_; }
+  void *Data() { return buckets_; }
+  size_t DataBytes() const { return len_; }
+
   std::string Info() const {
     std::stringstream ss;
     ss << "PackedHashtable with tag size: " << bits_per_tag << " bits";
@@ -57,6 +81,7 @@ class PackedTable {
     ss << "\t\tAssociativity: 4\n";
     ss << "\t\tTotal # of rows: " << num_buckets_ << "\n";
     ss << "\t\ttotal # slots: " << SizeInTags() << "\n";
+    ss << "\t\tPages: " << (mem_.data() ? mem_.Info() : "mapped") << "\n";
     return ss.str();
   }
 
@@ -206,6 +231,12 @@ class PackedTable {
     DPRINTF(DEBUG_TABLE, "PackedTable::ReadBucket done \n");
   }
 
+  // copies a whole bucket of tags (0 = empty slot) into bucket i
+  inline void CopyBucket(const size_t i, const uint32_t tags[4]) {
+    uint32_t sorted[4] = {tags[0], tags[1], tags[2], tags[3]};
+    WriteBucket(i, sorted, true);
+  }
+
   /* Tag = 4 low bits + x high bits
    * L L L L H H H H ...
    */
@@ -350,6 +381,11 @@ class PackedTable {
            (tags2[2] == tag) || (tags2[3] == tag);
   }
 
+  // pulls bucket i into cache ahead of a FindTagInBucket(i, ...)
+  void PrefetchBucket(const size_t i) const {
+    __builtin_prefetch(buckets_ + kBitsPerBucket * i / 8);
+  }
+
   bool FindTagInBucket(const size_t i, const uint32_t tag) const {
     DPRINTF(DEBUG_TABLE, "PackedTable::FindTagInBucket %zu\n", i);
     uint32_t tags[4];
@@ -0,0 +1,190 @@
+#ifndef CUCKOO_FILTER_PAGE_ALLOC_H_
+#define CUCKOO_FILTER_PAGE_ALLOC_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include <new>
+#include <sstream>
+#include <string>
+#include <utility>
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+#endif
+
+namespace cuckoofilter {
+
+// how the memory of a table or seed array is obtained, or'ed together:
+//   kHugePages             - MAP_HUGETLB, 1GB pages when the buffer is big enough
+//                            for them, else 2MB pages; needs pages reserved in
+//                            /proc/sys/vm/nr_hugepages (or the 1GB pool)
+//   kTransparentHugePages  - 2MB aligned anonymous mapping with madvise(MADV_HUGEPAGE)
+//   kPopulatePages         - fault every page in up front (MAP_POPULATE) instead of
+//                            on first touch
+// Each step falls back to the next one when the kernel refuses it:
+// hugetlb -> transparent huge pages -> normal pages, so any setting works everywhere.
+enum PageFlags {
+  kNormalPages = 0,
+  kHugePages = 1,
+  kTransparentHugePages = 2,
+  kPopulatePages = 4,
+};
+
+// zero-filled, at least cache line aligned buffer allocated according to PageFlags
+class PageBuffer {
+  enum Kind { kNone, kMalloc, kHugetlb, kTransparent };
+
+  static const size_t k2MB = 1ULL << 21;
+  static const size_t k1GB = 1ULL << 30;
+
+  void *data_;
+  size_t size_;    // bytes asked for
+  size_t mapped_;  // bytes mapped, for munmap
+  int flags_;      // PageFlags asked for, reused by copies
+  Kind kind_;
+  size_t page_;    // hugetlb page size, 0 otherwise
+
+  static size_t RoundUp(size_t x, size_t a) { return (x + a - 1) / a * a; }
+
+  bool MapHuge(size_t page, int huge_flag) {
+#ifdef MAP_HUGETLB
+    const size_t len = RoundUp(size_, page);
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | huge_flag;
+#ifdef MAP_POPULATE
+    if (flags_ & kPopulatePages) flags |= MAP_POPULATE;
+#endif
+    void *p = mmap(NULL, len, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (p == MAP_FAILED) return false;
+    data_ = p;
+    mapped_ = len;
+    kind_ = kHugetlb;
+    page_ = page;
+    return true;
+#else
+    (void)page;
+    (void)huge_flag;
+    return false;
+#endif
+  }
+
+  bool MapTransparent() {
+#ifdef MADV_HUGEPAGE
+    // over-map by 2MB and trim, so the buffer starts on a huge page boundary
+    const size_t len = RoundUp(size_, k2MB);
+    void *p = mmap(NULL, len + k2MB, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) return false;
+    char *start = reinterpret_cast<char *>(RoundUp(reinterpret_cast<uintptr_t>(p), k2MB));
+    const size_t head = start - static_cast<char *>(p);
+    if (head) munmap(p, head);
+    if (k2MB - head) munmap(start + len, k2MB - head);
+    madvise(start, len, MADV_HUGEPAGE);
+    if (flags_ & kPopulatePages) {
+      // write one byte per 4KB page, which the kernel backs with huge pages where it can
+      for (size_t i = 0; i < len; i += 4096) start[i] = 0;
+    }
+    data_ = start;
+    mapped_ = len;
+    kind_ = kTransparent;
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  void Allocate() {
+    if (size_ == 0) return;
+    if (flags_ & kHugePages) {
+      // 1GB pages only when rounding up to them wastes less than 1/8 of the buffer
+      if (size_ >= k1GB && RoundUp(size_, k1GB) - size_ <= size_ / 8 &&
+          MapHuge(k1GB, MAP_HUGE_1GB))
+        return;
+      if (MapHuge(k2MB, MAP_HUGE_2MB)) return;
+    }
+    if ((flags_ & (kHugePages | kTransparentHugePages)) && size_ >= k2MB && MapTransparent())
+      return;
+    const size_t len = RoundUp(size_, 64);
+    if (posix_memalign(&data_, 64, len)) throw ::std::bad_alloc();
+    memset(data_, 0, len);
+    mapped_ = len;
+    kind_ = kMalloc;
+  }
+
+  void Release() {
+    if (kind_ == kHugetlb || kind_ == kTransparent)
+      munmap(data_, mapped_);
+    else if (kind_ == kMalloc)
+      free(data_);
+    data_ = NULL;
+    kind_ = kNone;
+    page_ = 0;
+  }
+
+ public:
+  explicit PageBuffer(const size_t bytes = 0, const int flags = kNormalPages)
+      : data_(NULL), size_(bytes), mapped_(0), flags_(flags), kind_(kNone), page_(0) {
+    Allocate();
+  }
+
+  PageBuffer(const PageBuffer &other)
+      : data_(NULL), size_(other.size_), mapped_(0), flags_(other.flags_), kind_(kNone), page_(0) {
+    Allocate();
+    if (size_) memcpy(data_, other.data_, size_);
+  }
+
+  PageBuffer(PageBuffer &&other) noexcept
+      : data_(NULL), size_(0), mapped_(0), flags_(kNormalPages), kind_(kNone), page_(0) {
+    Swap(other);
+  }
+
+  PageBuffer &operator=(PageBuffer &&other) noexcept {
+    Swap(other);
+    return *this;
+  }
+
+  PageBuffer &operator=(const PageBuffer &other) {
+    if (this != &other) {
+      PageBuffer copy(other);
+      Swap(copy);
+    }
+    return *this;
+  }
+
+  ~PageBuffer() { Release(); }
+
+  void Swap(PageBuffer &other) noexcept {
+    std::swap(data_, other.data_);
+    std::swap(size_, other.size_);
+    std::swap(mapped_, other.mapped_);
+    std::swap(flags_, other.flags_);
+    std::swap(kind_, other.kind_);
+    std::swap(page_, other.page_);
+  }
+
+  void *data() const { return data_; }
+  size_t size() const { return size_; }
+  int flags() const { return flags_; }
+
+  std::string Info() const {
+    std::stringstream ss;
+    if (kind_ == kHugetlb)
+      ss << (page_ == k1GB ? "1GB" : "2MB") << " huge pages";
+    else if (kind_ == kTransparent)
+      ss << "transparent huge pages";
+    else
+      ss << "normal pages";
+    return ss.str();
+  }
+};
+}  // namespace cuckoofilter
+
+#endif  // CUCKOO_FILTER_PAGE_ALLOC_H_
@@ -0,0 +1,181 @@
+#ifndef CUCKOO_FILTER_RANGE_CODER_H_
+#define CUCKOO_FILTER_RANGE_CODER_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+namespace cuckoofilter {
+
+// adaptive binary range coder (the one of LZMA): every bit is coded with a
+// probability, kept in a BitModel, that follows the bits seen before in its
+// context, so a bit that is nearly always 0 costs a small fraction of a bit.
+// Bits that are as good as random (e.g. the tags of a filter) go through
+// EncodeDirect at one bit each. Both ends stream through a small buffer to
+// and from a FILE, the output is never held whole in memory.
+const int kModelBits = 11;
+const uint32_t kModelOne = 1u << kModelBits;
+const int kModelMove = 5;
+const uint32_t kRangeTop = 1u << 24;
+const size_t kCoderBuffer = 1 << 16;
+
+// probability of a 0 bit, in units of 1 / kModelOne
+struct BitModel {
+  uint16_t p;
+  BitModel() : p(kModelOne / 2) {}
+};
+
+class RangeEncoder {
+  FILE *out_;
+  std::vector<uint8_t> buf_;
+  uint64_t bytes_;
+  uint64_t low_;
+  uint32_t range_;
+  uint8_t cache_;
+  uint64_t cache_size_;
+
+  void Put(const uint8_t b) {
+    buf_.push_back(b);
+    if (buf_.size() == kCoderBuffer) Flush();
+  }
+
+  void Flush() {
+    if (!buf_.empty() && fwrite(buf_.data(), 1, buf_.size(), out_) != buf_.size())
+      throw std::runtime_error("could not write compressed filter");
+    bytes_ += buf_.size();
+    buf_.clear();
+  }
+
+  // a byte of low_ goes out once no carry can reach it any more
+  void ShiftLow() {
+    if ((uint32_t)low_ < 0xff000000u || (low_ >> 32) != 0) {
+      const uint8_t carry = low_ >> 32;
+      uint8_t b = cache_;
+      do {
+        Put(b + carry);
+        b = 0xff;
+      } while (--cache_size_ != 0);
+      cache_ = (low_ >> 24) & 0xff;
+    }
+    cache_size_++;
+    low_ = (low_ & 0x00ffffff) << 8;
+  }
+
+  // a coded bit leaves at least 2^16 of range, one byte shift is always enough
+  void Normalize() {
+    if (range_ < kRangeTop) {
+      range_ <<= 8;
+      ShiftLow();
+    }
+  }
+
+ public:
+  explicit RangeEncoder(FILE *out)
+      : out_(out), bytes_(0), low_(0), range_(0xffffffffu), cache_(0), cache_size_(1) {
+    buf_.reserve(kCoderBuffer);
+  }
+
+  void Encode(BitModel &m, const uint32_t bit) {
+    const uint32_t bound = (range_ >> kModelBits) * m.p;
+    if (!bit) {
+      range_ = bound;
+      m.p += (kModelOne - m.p) >> kModelMove;
+    } else {
+      low_ += bound;
+      range_ -= bound;
+      m.p -= m.p >> kModelMove;
+    }
+    Normalize();
+  }
+
+  // the low n bits of v, highest first, one bit each
+  void EncodeDirect(const uint32_t v, int n) {
+    while (n--) {
+      range_ >>= 1;
+      if ((v >> n) & 1) low_ += range_;
+      Normalize();
+    }
+  }
+
+  // writes out what is left, returns the bytes of the whole stream
+  uint64_t Finish() {
+    for (int i = 0; i < 5; i++) ShiftLow();
+    Flush();
+    return bytes_;
+  }
+};
+
+class RangeDecoder {
+  FILE *in_;
+  std::vector<uint8_t> buf_;
+  size_t pos_, end_;
+  uint64_t bytes_;
+  uint64_t limit_;
+  uint32_t range_;
+  uint32_t code_;
+
+  uint8_t Get() {
+    if (pos_ == end_) {
+      if (bytes_ == limit_) throw std::runtime_error("compressed filter truncated or corrupt");
+      const size_t want = std::min<uint64_t>(buf_.size(), limit_ - bytes_);
+      end_ = fread(buf_.data(), 1, want, in_);
+      pos_ = 0;
+      if (end_ == 0) throw std::runtime_error("compressed filter truncated or corrupt");
+    }
+    bytes_++;
+    return buf_[pos_++];
+  }
+
+  void Normalize() {
+    if (range_ < kRangeTop) {
+      range_ <<= 8;
+      code_ = (code_ << 8) | Get();
+    }
+  }
+
+ public:
+  // decodes the next limit bytes of in, the stream an encoder wrote
+  RangeDecoder(FILE *in, const uint64_t limit)
+      : in_(in), buf_(kCoderBuffer), pos_(0), end_(0), bytes_(0), limit_(limit),
+        range_(0xffffffffu), code_(0) {
+    for (int i = 0; i < 5; i++) code_ = (code_ << 8) | Get();
+  }
+
+  uint32_t Decode(BitModel &m) {
+    const uint32_t bound = (range_ >> kModelBits) * m.p;
+    uint32_t bit;
+    if (code_ < bound) {
+      range_ = bound;
+      m.p += (kModelOne - m.p) >> kModelMove;
+      bit = 0;
+    } else {
+      code_ -= bound;
+      range_ -= bound;
+      m.p -= m.p >> kModelMove;
+      bit = 1;
+    }
+    Normalize();
+    return bit;
+  }
+
+  uint32_t DecodeDirect(int n) {
+    uint32_t v = 0;
+    while (n--) {
+      range_ >>= 1;
+      const uint32_t bit = code_ >= range_;
+      if (bit) code_ -= range_;
+      v = (v << 1) | bit;
+      Normalize();
+    }
+    return v;
+  }
+
+  // whether the whole stream was used, as it is when it decoded right
+  bool Done() const { return bytes_ == limit_; }
+};
+}  // namespace cuckoofilter
+
+#endif  // CUCKOO_FILTER_RANGE_CODER_H_
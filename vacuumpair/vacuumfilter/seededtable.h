@@ -0,0 +1,245 @@
+#ifndef CUCKOO_FILTER_SEEDED_TABLE_H_
+#define CUCKOO_FILTER_SEEDED_TABLE_H_
+
+#include <assert.h>
+#include <string.h>
+
+#include <algorithm>
+#include <sstream>
+#include <utility>
+#include <vector>
+
+#include "bitsutil.h"
+#include "debug.h"
+#include "pagealloc.h"
+#include "printutil.h"
+
+namespace cuckoofilter {
+
+// like SingleTable, but every bucket is one aligned 64-bit word holding the
+// four tags in its low bits and the bucket's seed in the bits left over, so
+// a lookup reads the seed and probes the tags with a single memory access.
+// For 12-bit tags the seed gets 16 bits. A seed that does not fit is stored
+// as all ones and kept in a sorted overflow table, as in SeedTable.
+// The array is cache line aligned, so each run of 8 buckets starting at a
+// multiple of 8 is exactly one line (see the blocked VacuumFilter).
+template <size_t bits_per_tag>
+class SeededTable {
+  static const size_t kTagsPerBucket = 4;
+  static_assert(bits_per_tag * kTagsPerBucket <= 56,
+                "SeededTable needs at least 8 seed bits next to the tags");
+
+  static const uint32_t kTagMask = (1ULL << bits_per_tag) - 1;
+  static const size_t kSeedShift = bits_per_tag * kTagsPerBucket;
+  static const size_t kSeedBits = 64 - kSeedShift < 32 ? 64 - kSeedShift : 32;
+  static const uint64_t kSeedMask = ((1ULL << kSeedBits) - 1) << kSeedShift;
+  // a seed of kEscape (or above) lives in overflow_
+  static const uint32_t kEscape = (1ULL << kSeedBits) - 1;
+
+  // lowest bit and highest bit of every tag, for the zero-tag test below
+  static const uint64_t kTagLows = 1ULL | (1ULL << bits_per_tag) |
+                                   (1ULL << 2 * bits_per_tag) | (1ULL << 3 * bits_per_tag);
+  static const uint64_t kTagHighs = kTagLows << (bits_per_tag - 1);
+
+ public:
+  // (bucket, seed) of a seed too big for its bucket
+  typedef std::pair<uint32_t, uint32_t> Overflow;
+
+ private:
+  uint64_t *buckets_;
+  size_t num_buckets_;
+  PageBuffer mem_;
+  std::vector<Overflow> overflow_;
+
+  static bool OverflowLess(const Overflow &a, const uint32_t i) {
+    return a.first < i;
+  }
+
+ public:
+  static const bool kSeedsInBuckets = true;
+  // table kind in a filter file (filterfile.h)
+  static const uint32_t kTableId = 3;
+
+  // pages: PageFlags for the bucket array
+  explicit SeededTable(const size_t num, const int pages = kNormalPages)
+      : num_buckets_(num), mem_(sizeof(uint64_t) * num, pages) {
+    buckets_ = static_cast<uint64_t *>(mem_.data());
+  }
+
+  // read-only table over DataBytes() of buckets kept elsewhere, e.g. in a
+  // mapped filter file; data must outlive the table. The few overflow seeds
+  // are copied
+  SeededTable(const size_t num, const void *data, const Overflow *overflow = NULL, const size_t num_overflow = 0)
+      : num_buckets_(num), overflow_(overflow, overflow + num_overflow) {
+    buckets_ = static_cast<uint64_t *>(const_cast<void *>(data));
+  }
+
+  // deep copy, in memory allocated with the same PageFlags
+  SeededTable(const SeededTable &other)
+      : num_buckets_(other.num_buckets_), mem_(other.DataBytes(), other.mem_.flags()), overflow_(other.overflow_) {
+    buckets_ = static_cast<uint64_t *>(mem_.data());
+    if (num_buckets_) memcpy(buckets_, other.buckets_, DataBytes());
+  }
+
+  SeededTable &operator=(const SeededTable &) = delete;
+
+  size_t NumBuckets() const {
+    return num_buckets_;
+  }
+
+  size_t SizeInBytes() const {
+    return sizeof(uint64_t) * num_buckets_ + sizeof(Overflow) * overflow_.size();
+  }
+
+  size_t SizeInTags() const {
+    return kTagsPerBucket * num_buckets_;
+  }
+
+  // the bucket array and the sorted overflow seeds as stored
+  const void *Data() const { return buckets_; }
+  void *Data() { return buckets_; }
+  size_t DataBytes() const { return sizeof(uint64_t) * num_buckets_; }
+  const Overflow *OverflowData() const { return overflow_.data(); }
+  size_t NumOverflow() const { return overflow_.size(); }
+
+  // replaces the overflow seeds, sorted by bucket, e.g. with those of a patch
+  void SetOverflow(const Overflow *overflow, const size_t num_overflow) {
+    overflow_.assign(overflow, overflow + num_overflow);
+  }
+
+  std::string Info() const {
+    std::stringstream ss;
+    ss << "SeededHashtable with tag size: " << bits_per_tag << " bits, seed size: "
+       << kSeedBits << " bits \n";
+    ss << "\t\tAssociativity: " << kTagsPerBucket << "\n";
+    ss << "\t\tTotal # of rows: " << num_buckets_ << "\n";
+    ss << "\t\tTotal # slots: " << SizeInTags() << "\n";
+    ss << "\t\tOverflow seeds: " << overflow_.size() << "\n";
+    ss << "\t\tPages: " << (mem_.data() ? mem_.Info() : "mapped") << "\n";
+    return ss.str();
+  }
+
+  inline uint32_t ReadSeed(const size_t i) const {
+    const uint32_t s = (buckets_[i] & kSeedMask) >> kSeedShift;
+    if (s != kEscape) return s;
+    auto it = std::lower_bound(overflow_.begin(), overflow_.end(), i, OverflowLess);
+    assert(it != overflow_.end() && it->first == i);
+    return it->second;
+  }
+
+  inline void WriteSeed(const size_t i, const uint32_t seed) {
+    const bool spilled = ((buckets_[i] & kSeedMask) >> kSeedShift) == kEscape;
+    auto it = std::lower_bound(overflow_.begin(), overflow_.end(), i, OverflowLess);
+    uint64_t s = seed;
+    if (seed < kEscape) {
+      if (spilled) overflow_.erase(it);
+    } else {
+      if (spilled)
+        it->second = seed;
+      else
+        overflow_.insert(it, Overflow(i, seed));
+      s = kEscape;
+    }
+    buckets_[i] = (buckets_[i] & ~kSeedMask) | (s << kSeedShift);
+  }
+
+  // read tag from pos(i,j)
+  inline uint32_t ReadTag(const size_t i, const size_t j) const {
+    return (buckets_[i] >> (j * bits_per_tag)) & kTagMask;
+  }
+
+  // write tag to pos(i,j)
+  inline void WriteTag(const size_t i, const size_t j, const uint32_t t) {
+    const size_t shift = j * bits_per_tag;
+    buckets_[i] = (buckets_[i] & ~((uint64_t)kTagMask << shift)) |
+                  ((uint64_t)(t & kTagMask) << shift);
+  }
+
+  // vacuum - assuming 4 slots per bucket
+  inline void ReadBucket(const size_t i, uint32_t *tag) const {
+    tag[0] = ReadTag(i, 0);
+    tag[1] = ReadTag(i, 1);
+    tag[2] = ReadTag(i, 2);
+    tag[3] = ReadTag(i, 3);
+  }
+
+  inline bool FindTagInBuckets(const size_t i1, const size_t i2,
+                               const uint32_t tag) const {
+    return FindTagInBucket(i1, tag) || FindTagInBucket(i2, tag);
+  }
+
+  // pulls bucket i, seed included, into cache ahead of a ReadSeed(i) or FindTagInBucket(i, ...)
+  inline void PrefetchBucket(const size_t i) const {
+    __builtin_prefetch(&buckets_[i]);
+  }
+
+  inline bool FindTagInBucket(const size_t i, const uint32_t tag) const {
+    // same zero-field test as hasvalue12 and friends, for any tag width; the
+    // seed bits above the tags can borrow but are masked out by kTagHighs
+    const uint64_t x = buckets_[i] ^ (kTagLows * tag);
+    return ((x - kTagLows) & ~x & kTagHighs) != 0;
+  }
+
+  inline bool DeleteTagFromBucket(const size_t i, const uint32_t tag) {
+    for (size_t j = 0; j < kTagsPerBucket; j++) {
+      if (ReadTag(i, j) == tag) {
+        assert(FindTagInBucket(i, tag) == true);
+        WriteTag(i, j, 0);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  inline bool InsertTagToBucket(const size_t i, const uint32_t tag,
+                                const bool kickout, uint32_t &oldtag, uint32_t *tags) {
+    for (size_t j = 0; j < kTagsPerBucket; j++) {
+      tags[j] = ReadTag(i, j);
+      if (tags[j] == 0) {
+        WriteTag(i, j, tag);
+        return true;
+      }
+    }
+    if (kickout) {
+      size_t r = rand() % kTagsPerBucket;
+      oldtag = tags[r];
+      WriteTag(i, r, tag);
+    }
+    return false;
+  }
+
+  // copies tag into specified index and slot in table
+  inline bool CopyTagToBucket(const size_t i, const size_t j,
+                              const uint32_t tag) {
+    if (ReadTag(i, j) == 0) {
+      WriteTag(i, j, tag);
+      return true;
+    }
+    return false;
+  }
+
+  // copies a whole bucket of tags (0 = empty slot) into bucket i, keeping its seed
+  inline void CopyBucket(const size_t i, const uint32_t tags[kTagsPerBucket]) {
+    uint64_t v = buckets_[i] & kSeedMask;
+    for (size_t j = 0; j < kTagsPerBucket; j++) {
+      v |= (uint64_t)(tags[j] & kTagMask) << (j * bits_per_tag);
+    }
+    buckets_[i] = v;
+  }
+
+  inline void WriteBucket(const size_t i, uint32_t tags[4], bool sort = true, int pos = 4) {
+      WriteTag(i, pos, tags[pos]);
+  }
+
+  inline size_t NumTagsInBucket(const size_t i) const {
+    size_t num = 0;
+    for (size_t j = 0; j < kTagsPerBucket; j++) {
+      if (ReadTag(i, j) != 0) {
+        num++;
+      }
+    }
+    return num;
+  }
+};
+}  // namespace cuckoofilter
+#endif  // CUCKOO_FILTER_SEEDED_TABLE_H_
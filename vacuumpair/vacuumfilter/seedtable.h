@@ -0,0 +1,170 @@
+#ifndef CUCKOO_FILTER_SEED_TABLE_H_
+#define CUCKOO_FILTER_SEED_TABLE_H_
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <sstream>
+#include <utility>
+#include <vector>
+
+#include "pagealloc.h"
+
+namespace cuckoofilter {
+
+// per-bucket rehash seeds, bits_per_seed bits each in one bit array. Most
+// buckets are rehashed only a few times, so the rare seeds that do not fit
+// are stored as all ones in the array and kept in a small overflow table of
+// (bucket, seed) pairs sorted by bucket. Seeds are 32-bit, so a bucket can be
+// rehashed any number of times.
+template <size_t bits_per_seed = 4>
+class SeedTable {
+  static_assert(bits_per_seed > 0 && bits_per_seed < 32 && 64 % bits_per_seed == 0,
+                "bits_per_seed must divide 64");
+
+  static const size_t kSeedsPerWord = 64 / bits_per_seed;
+  static const uint64_t kSeedMask = (1ULL << bits_per_seed) - 1;
+  // a seed of kEscape (or above) lives in overflow_
+  static const uint32_t kEscape = kSeedMask;
+
+ public:
+  // (bucket, seed) of a seed that does not fit bits_per_seed
+  typedef std::pair<uint32_t, uint32_t> Overflow;
+
+ private:
+  size_t num_buckets_;
+  PageBuffer words_; // (num_buckets_ + kSeedsPerWord - 1) / kSeedsPerWord words, empty when mapped
+  uint64_t *data_;   // words_, or the words of a mapped filter file
+  std::vector<Overflow> overflow_;
+
+  inline uint64_t *words() const {
+    return data_;
+  }
+
+  inline uint32_t ReadSlot(const size_t i) const {
+    return (words()[i / kSeedsPerWord] >> ((i % kSeedsPerWord) * bits_per_seed)) & kSeedMask;
+  }
+
+  inline void WriteSlot(const size_t i, const uint64_t v) {
+    const size_t shift = (i % kSeedsPerWord) * bits_per_seed;
+    uint64_t &w = words()[i / kSeedsPerWord];
+    w = (w & ~(kSeedMask << shift)) | (v << shift);
+  }
+
+  static bool OverflowLess(const Overflow &a, const uint32_t i) {
+    return a.first < i;
+  }
+
+ public:
+  static const size_t kBitsPerSeed = bits_per_seed;
+  // tells the seed tables apart in a filter file (FileHeader::seeds_id)
+  static const uint32_t kSeedsId = bits_per_seed;
+
+  // pages: PageFlags for the packed seeds, kept by copies
+  explicit SeedTable(const size_t num = 0, const int pages = kNormalPages)
+      : num_buckets_(num), words_(WordBytes(num), pages) {
+    data_ = static_cast<uint64_t *>(words_.data());
+  }
+
+  // read-only seeds over WordBytes() of packed words kept elsewhere, e.g. in
+  // a mapped filter file; words must outlive the table. The few overflow
+  // seeds are copied
+  SeedTable(const size_t num, const void *words, const Overflow *overflow, const size_t num_overflow)
+      : num_buckets_(num), data_(static_cast<uint64_t *>(const_cast<void *>(words))),
+        overflow_(overflow, overflow + num_overflow) {}
+
+  // copy of other with its packed seeds allocated according to pages
+  SeedTable(const SeedTable &other, const int pages)
+      : num_buckets_(other.num_buckets_), words_(other.WordBytes(), pages), overflow_(other.overflow_) {
+    data_ = static_cast<uint64_t *>(words_.data());
+    if (words_.size()) memcpy(data_, other.data_, words_.size());
+  }
+
+  SeedTable(const SeedTable &other) : SeedTable(other, other.words_.flags()) {}
+
+  SeedTable(SeedTable &&other) noexcept
+      : num_buckets_(other.num_buckets_), words_(std::move(other.words_)), data_(other.data_),
+        overflow_(std::move(other.overflow_)) {
+    other.num_buckets_ = 0;
+    other.data_ = NULL;
+  }
+
+  SeedTable &operator=(SeedTable other) {
+    std::swap(num_buckets_, other.num_buckets_);
+    words_.Swap(other.words_);
+    std::swap(data_, other.data_);
+    overflow_.swap(other.overflow_);
+    return *this;
+  }
+
+  size_t size() const { return num_buckets_; }
+
+  uint32_t get(const size_t i) const {
+    assert(i < num_buckets_);
+    const uint32_t s = ReadSlot(i);
+    if (s != kEscape) return s;
+    auto it = std::lower_bound(overflow_.begin(), overflow_.end(), i, OverflowLess);
+    assert(it != overflow_.end() && it->first == i);
+    return it->second;
+  }
+
+  void set(const size_t i, const uint32_t seed) {
+    assert(i < num_buckets_);
+    const bool spilled = ReadSlot(i) == kEscape;
+    if (seed < kEscape) {
+      if (spilled)
+        overflow_.erase(std::lower_bound(overflow_.begin(), overflow_.end(), i, OverflowLess));
+      WriteSlot(i, seed);
+      return;
+    }
+    auto it = std::lower_bound(overflow_.begin(), overflow_.end(), i, OverflowLess);
+    if (spilled)
+      it->second = seed;
+    else
+      overflow_.insert(it, Overflow(i, seed));
+    WriteSlot(i, kEscape);
+  }
+
+  // pulls the packed seed of bucket i into cache ahead of a get(i)
+  void prefetch(const size_t i) const {
+    __builtin_prefetch(&words()[i / kSeedsPerWord]);
+  }
+
+  // packed words of num seeds
+  static size_t WordBytes(const size_t num) {
+    return sizeof(uint64_t) * ((num + kSeedsPerWord - 1) / kSeedsPerWord);
+  }
+
+  // whether bytes of words (from a filter file) hold seeds of num buckets
+  static bool ValidWords(const size_t num, const void *, const size_t bytes) {
+    return bytes == WordBytes(num);
+  }
+
+  // the packed words and the sorted overflow seeds as stored
+  const void *WordData() const { return data_; }
+  void *WordData() { return data_; }
+  size_t WordBytes() const { return WordBytes(num_buckets_); }
+  const Overflow *OverflowData() const { return overflow_.data(); }
+  size_t NumOverflow() const { return overflow_.size(); }
+
+  // replaces the overflow seeds, sorted by bucket, e.g. with those of a patch
+  void SetOverflow(const Overflow *overflow, const size_t num_overflow) {
+    overflow_.assign(overflow, overflow + num_overflow);
+  }
+
+  size_t SizeInBytes() const {
+    return WordBytes() + sizeof(Overflow) * overflow_.size();
+  }
+
+  std::string Info() const {
+    std::stringstream ss;
+    ss << "SeedTable with seed size: " << bits_per_seed << " bits, "
+       << overflow_.size() << " overflow seeds\n";
+    return ss.str();
+  }
+};
+}  // namespace cuckoofilter
+
+#endif  // CUCKOO_FILTER_SEED_TABLE_H_
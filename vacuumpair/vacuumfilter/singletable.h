@@ -2,11 +2,18 @@
 #define CUCKOO_FILTER_SINGLE_TABLE_H_
 
 #include <assert.h>
+#include <string.h>
 
 #include <sstream>
+#include <type_traits>
+
+#ifdef __SSSE3__
+#include <immintrin.h>
+#endif
 
 #include "bitsutil.h"
 #include "debug.h"
+#include "pagealloc.h"
 #include "printutil.h"
 
 namespace cuckoofilter {
@@ -14,14 +21,29 @@ namespace cuckoofilter {
 // the most naive table implementation: one huge bit array
 template <size_t bits_per_tag>
 class SingleTable {
+  static_assert(bits_per_tag >= 2 && bits_per_tag <= 32, "SingleTable supports 2 to 32 bit tags");
+
   static const size_t kTagsPerBucket = 4;
   static const size_t kBytesPerBucket =
       (bits_per_tag * kTagsPerBucket + 7) >> 3;
   static const uint32_t kTagMask = (1ULL << bits_per_tag) - 1;
   // NOTE: accomodate extra buckets if necessary to avoid overrun
-  // as we always read a uint64
+  // as we always read 16 bytes (a bucket word, an SSE vector or a
+  // uint64 at the byte of a tag) from the start of a bucket
   static const size_t kPaddingBuckets =
-    ((((kBytesPerBucket + 7) / 8) * 8) - 1) / kBytesPerBucket;
+    (16 + kBytesPerBucket - 1) / kBytesPerBucket;
+
+  // a whole bucket in one integer, tag j at bit j * bits_per_tag
+  typedef typename std::conditional<bits_per_tag * kTagsPerBucket <= 64,
+                                    uint64_t, unsigned __int128>::type Word;
+
+  // lowest and highest bit of every tag in a Word, for the zero-tag test
+  // of haszero12 and friends generalized to any tag width
+  static inline Word TagLows() {
+    return (Word)1 | ((Word)1 << bits_per_tag) | ((Word)1 << 2 * bits_per_tag) |
+           ((Word)1 << 3 * bits_per_tag);
+  }
+  static inline Word TagHighs() { return TagLows() << (bits_per_tag - 1); }
 
   struct Bucket {
     char bits_[kBytesPerBucket];
@@ -30,17 +52,67 @@ class SingleTable {
   // using a pointer adds one more indirection
   Bucket *buckets_;
   size_t num_buckets_;
+  PageBuffer mem_;
+
+  // byte holding bit `bit` of bucket i, addressed through the whole array
+  // since 8-byte accesses there run past the bucket
+  inline char *ByteOf(const size_t i, const size_t bit) const {
+    return reinterpret_cast<char *>(buckets_) + kBytesPerBucket * i + (bit >> 3);
+  }
+
+#ifdef __SSSE3__
+  // the four tags of the bucket at p, one per 32-bit lane (16-byte load,
+  // 24-bit tags are spread out by a byte shuffle)
+  static inline __m128i LoadTags(const char *p) {
+    const __m128i v = _mm_loadu_si128((const __m128i *)p);
+    if (bits_per_tag == 24)
+      return _mm_shuffle_epi8(v, _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1));
+    return v;
+  }
+#endif
+
+  // whether the bucket at p holds tag, without branches: an SSE compare
+  // for 24/32-bit tags, else the SWAR zero-tag test on the bucket word
+  // (x - lows) & ~x & highs, which is exact as a yes/no answer
+  static inline bool HasTag(const char *p, const uint32_t tag) {
+    // caution: unaligned access & assuming little endian
+#ifdef __SSSE3__
+    if (bits_per_tag == 24 || bits_per_tag == 32)
+      return _mm_movemask_epi8(_mm_cmpeq_epi32(LoadTags(p), _mm_set1_epi32(tag))) != 0;
+#endif
+    Word v;
+    memcpy(&v, p, sizeof(v));
+    const Word x = v ^ (TagLows() * tag);
+    return ((x - TagLows()) & ~x & TagHighs()) != 0;
+  }
 
  public:
-  explicit SingleTable(const size_t num) : num_buckets_(num) {
-    buckets_ = new Bucket[num_buckets_ + kPaddingBuckets];
-    memset(buckets_, 0, kBytesPerBucket * (num_buckets_ + kPaddingBuckets));
+  // seeds are kept by the filter, next to the table
+  static const bool kSeedsInBuckets = false;
+  // table kind in a filter file (filterfile.h)
+  static const uint32_t kTableId = 1;
+
+  // pages: PageFlags for the bucket array
+  explicit SingleTable(const size_t num, const int pages = kNormalPages)
+      : num_buckets_(num), mem_(kBytesPerBucket * (num_buckets_ + kPaddingBuckets), pages) {
+    buckets_ = static_cast<Bucket *>(mem_.data());
   }
 
-  ~SingleTable() { 
-    delete[] buckets_;
+  // read-only table over DataBytes() of buckets kept elsewhere, e.g. in a
+  // mapped filter file; data must outlive the table
+  SingleTable(const size_t num, const void *data) : num_buckets_(num) {
+    buckets_ = static_cast<Bucket *>(const_cast<void *>(data));
   }
 
+  // deep copy, in memory allocated with the same PageFlags
+  SingleTable(const SingleTable &other)
+      : num_buckets_(other.num_buckets_), mem_(other.DataBytes(), other.mem_.flags()) {
+    buckets_ = static_cast<Bucket *>(mem_.data());
+    memcpy(buckets_, other.buckets_, DataBytes());
+  }
+
+  SingleTable &operator=(const SingleTable &) = delete;
+
   size_t NumBuckets() const {
     return num_buckets_;
   }
@@ -49,6 +121,11 @@ class SingleTable {
     return kBytesPerBucket * num_buckets_; 
   }
 
+  // the bucket array as stored, padding buckets included
+  const void *Data() const { return buckets_; }
+  void *Data() { return buckets_; }
+  size_t DataBytes() const { return kBytesPerBucket * (num_buckets_ + kPaddingBuckets); }
+
   size_t SizeInTags() const { 
     return kTagsPerBucket * num_buckets_; 
   }
@@ -59,6 +136,7 @@ class SingleTable {
     ss << "\t\tAssociativity: " << kTagsPerBucket << "\n";
     ss << "\t\tTotal # of rows: " << num_buckets_ << "\n";
     ss << "\t\tTotal # slots: " << SizeInTags() << "\n";
+    ss << "\t\tPages: " << (mem_.data() ? mem_.Info() : "mapped") << "\n";
     return ss.str();
   }
 
@@ -83,6 +161,12 @@ class SingleTable {
       tag = *((uint16_t *)p);
     } else if (bits_per_tag == 32) {
       tag = ((uint32_t *)p)[j];
+    } else {
+      // any other width: a tag spans at most 5 bytes from the byte it starts in
+      const size_t bit = j * bits_per_tag;
+      uint64_t w;
+      memcpy(&w, ByteOf(i, bit), sizeof(w));
+      tag = w >> (bit & 7);
     }
     return tag & kTagMask;
   }
@@ -118,11 +202,17 @@ class SingleTable {
       ((uint16_t *)p)[j] = tag;
     } else if (bits_per_tag == 32) {
       ((uint32_t *)p)[j] = tag;
+    } else {
+      const size_t bit = j * bits_per_tag;
+      uint64_t w;
+      memcpy(&w, ByteOf(i, bit), sizeof(w));
+      w = (w & ~((uint64_t)kTagMask << (bit & 7))) | ((uint64_t)tag << (bit & 7));
+      memcpy(ByteOf(i, bit), &w, sizeof(w));
     }
   }
 
   // vacuum - assuming 4 slots per bucket
-  inline void ReadBucket(const size_t i, uint32_t *tag)
+  inline void ReadBucket(const size_t i, uint32_t *tag) const
   {
     tag[0] = ReadTag(i, 0);
     tag[1] = ReadTag(i, 1);
@@ -132,63 +222,25 @@ class SingleTable {
 
   inline bool FindTagInBuckets(const size_t i1, const size_t i2,
                                const uint32_t tag) const {
-    // if (FindTagInBucket(i1, tag1))
-    //     return true; 
-    // if (FindTagInBucket(i2, tag2))
-    //     return true;
-    // return false;
-
     const char *p1 = buckets_[i1].bits_;
     const char *p2 = buckets_[i2].bits_;
-
-    uint64_t v1 = *((uint64_t *)p1);
-    uint64_t v2 = *((uint64_t *)p2);
-
-    // caution: unaligned access & assuming little endian
-    if (bits_per_tag == 4 && kTagsPerBucket == 4) {
-      return hasvalue4(v1, tag) || hasvalue4(v2, tag);
-    } else if (bits_per_tag == 8 && kTagsPerBucket == 4) {
-      return hasvalue8(v1, tag) || hasvalue8(v2, tag);
-    } else if (bits_per_tag == 12 && kTagsPerBucket == 4) {
-      return hasvalue12(v1, tag) || hasvalue12(v2, tag);
-    } else if (bits_per_tag == 16 && kTagsPerBucket == 4) {
-      return hasvalue16(v1, tag) || hasvalue16(v2, tag);
-    } else {
-      for (size_t j = 0; j < kTagsPerBucket; j++) {
-        if ((ReadTag(i1, j) == tag) || (ReadTag(i2, j) == tag)) {
-          return true;
-        }
-      }
-      return false;
+#ifdef __AVX2__
+    // byte aligned 24/32-bit tags: both buckets in one 256-bit compare
+    if (bits_per_tag == 24 || bits_per_tag == 32) {
+      const __m256i v = _mm256_setr_m128i(LoadTags(p1), LoadTags(p2));
+      return _mm256_movemask_epi8(_mm256_cmpeq_epi32(v, _mm256_set1_epi32(tag))) != 0;
     }
+#endif
+    return HasTag(p1, tag) | HasTag(p2, tag);
+  }
+
+  // pulls bucket i into cache ahead of a FindTagInBucket(i, ...)
+  inline void PrefetchBucket(const size_t i) const {
+    __builtin_prefetch(buckets_[i].bits_);
   }
 
   inline bool FindTagInBucket(const size_t i, const uint32_t tag) const {
-    // caution: unaligned access & assuming little endian
-    // if (bits_per_tag == 4 && kTagsPerBucket == 4) {
-    //   const char *p = buckets_[i].bits_;
-    //   uint64_t v = *(uint64_t *)p;  // uint16_t may suffice
-    //   return hasvalue4(v, tag);
-    // } else if (bits_per_tag == 8 && kTagsPerBucket == 4) {
-    //   const char *p = buckets_[i].bits_;
-    //   uint64_t v = *(uint64_t *)p;  // uint32_t may suffice
-    //   return hasvalue8(v, tag);
-    if (bits_per_tag == 12 && kTagsPerBucket == 4) {
-      const char *p = buckets_[i].bits_;
-      uint64_t v = *(uint64_t *)p;
-      return hasvalue12(v, tag);
-    // } else if (bits_per_tag == 16 && kTagsPerBucket == 4) {
-    //   const char *p = buckets_[i].bits_;
-    //   uint64_t v = *(uint64_t *)p;
-    //   return hasvalue16(v, tag);
-    } else {
-      for (size_t j = 0; j < kTagsPerBucket; j++) {
-        if (ReadTag(i, j) == tag) {
-          return true;
-        }
-      }
-      return false;
-    }
+    return HasTag(buckets_[i].bits_, tag);
   }
 
   inline bool DeleteTagFromBucket(const size_t i, const uint32_t tag) {
@@ -229,6 +281,23 @@ class SingleTable {
     return false;
   }
 
+  // copies a whole bucket of tags (0 = empty slot) into bucket i, packing
+  // them into one word and writing it at once when the bucket fits in 64 bits
+  inline void CopyBucket(const size_t i, const uint32_t tags[kTagsPerBucket]) {
+    if (bits_per_tag * kTagsPerBucket <= 64) {
+      uint64_t v = 0;
+      for (size_t j = 0; j < kTagsPerBucket; j++) {
+        v |= (uint64_t)(tags[j] & kTagMask) << (j * bits_per_tag);
+      }
+      /* following code only works for little-endian */
+      memcpy(buckets_[i].bits_, &v, kBytesPerBucket);
+    } else {
+      for (size_t j = 0; j < kTagsPerBucket; j++) {
+        WriteTag(i, j, tags[j]);
+      }
+    }
+  }
+
   inline void WriteBucket(const size_t i, uint32_t tags[4], bool sort = true, int pos = 4) {
       WriteTag(i, pos, tags[pos]);
   }
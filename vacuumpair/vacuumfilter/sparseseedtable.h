@@ -0,0 +1,205 @@
+#ifndef CUCKOO_FILTER_SPARSE_SEED_TABLE_H_
+#define CUCKOO_FILTER_SPARSE_SEED_TABLE_H_
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <sstream>
+#include <utility>
+#include <vector>
+
+#include "pagealloc.h"
+#include "seedtable.h"
+
+namespace cuckoofilter {
+
+// read-only per-bucket seeds for a built filter in which most buckets were
+// never rehashed (seed 0). Instead of bits_per_seed bits for every bucket it
+// keeps one bit per bucket (seed != 0), rank counts over that bit vector and
+// only the non-zero seeds, packed in bucket order. get(i) is constant time: a
+// zero bit answers 0 right away, otherwise the rank of the bit gives the slot
+// of the seed. Stored seeds are seed - 1, and as in SeedTable the ones that do
+// not fit are all ones in their slot and kept in a sorted overflow table.
+//
+// Everything but the overflow seeds is one array of 64-bit words, so a filter
+// file holds it as is (WordData):
+//   num_buckets, number of non-zero seeds,
+//   a count word per 256 buckets: ones before the block (low 32 bits), then
+//     ones in the block before its 2nd, 3rd and 4th bit word (bytes 5, 6, 7),
+//   the bit vector, the packed seeds.
+template <size_t bits_per_seed = 4>
+class SparseSeedTable {
+  static_assert(bits_per_seed > 0 && bits_per_seed < 32 && 64 % bits_per_seed == 0,
+                "bits_per_seed must divide 64");
+
+  static const size_t kSeedsPerWord = 64 / bits_per_seed;
+  static const uint64_t kSeedMask = (1ULL << bits_per_seed) - 1;
+  static const uint32_t kEscape = kSeedMask;
+  static const size_t kBlockBits = 256;
+  static const size_t kHeaderWords = 2;
+
+ public:
+  typedef typename SeedTable<bits_per_seed>::Overflow Overflow;
+
+ private:
+  size_t num_buckets_;
+  PageBuffer words_;  // empty when mapped
+  const uint64_t *data_;  // words_, or the words of a mapped filter file
+  const uint64_t *counts_;
+  const uint64_t *bits_;
+  const uint64_t *seeds_;
+  std::vector<Overflow> overflow_;
+
+  static size_t CountWords(const size_t num) { return (num + kBlockBits - 1) / kBlockBits; }
+  static size_t BitWords(const size_t num) { return (num + 63) / 64; }
+  static size_t SeedWords(const size_t nonzero) { return (nonzero + kSeedsPerWord - 1) / kSeedsPerWord; }
+
+  static size_t WordBytes(const size_t num, const size_t nonzero) {
+    return sizeof(uint64_t) * (kHeaderWords + CountWords(num) + BitWords(num) + SeedWords(nonzero));
+  }
+
+  void Point(const void *words) {
+    data_ = static_cast<const uint64_t *>(words);
+    if (!data_) {
+      counts_ = bits_ = seeds_ = NULL;
+      return;
+    }
+    counts_ = data_ + kHeaderWords;
+    bits_ = counts_ + CountWords(num_buckets_);
+    seeds_ = bits_ + BitWords(num_buckets_);
+  }
+
+  static bool OverflowLess(const Overflow &a, const uint32_t i) {
+    return a.first < i;
+  }
+
+ public:
+  static const size_t kBitsPerSeed = bits_per_seed;
+  // tells the seed tables apart in a filter file (FileHeader::seeds_id)
+  static const uint32_t kSeedsId = 0x100 | bits_per_seed;
+
+  SparseSeedTable() : num_buckets_(0) {
+    Point(NULL);
+  }
+
+  // the seeds of dense, which are final: this table has no set()
+  SparseSeedTable(const SeedTable<bits_per_seed> &dense, const int pages = kNormalPages)
+      : num_buckets_(dense.size()) {
+    size_t nonzero = 0;
+    for (size_t i = 0; i < num_buckets_; i++) nonzero += dense.get(i) != 0;
+    words_ = PageBuffer(WordBytes(num_buckets_, nonzero), pages);
+    uint64_t *w = static_cast<uint64_t *>(words_.data());
+    if (!w) {
+      Point(NULL);
+      return;
+    }
+    w[0] = num_buckets_;
+    w[1] = nonzero;
+    uint64_t *counts = w + kHeaderWords;
+    uint64_t *bits = counts + CountWords(num_buckets_);
+    uint64_t *seeds = bits + BitWords(num_buckets_);
+    size_t rank = 0;
+    for (size_t i = 0; i < num_buckets_; i++) {
+      if (i % kBlockBits == 0) counts[i / kBlockBits] = rank;
+      else if (i % 64 == 0)
+        counts[i / kBlockBits] |= uint64_t(rank - (uint32_t)counts[i / kBlockBits]) << (32 + 8 * (i % kBlockBits / 64));
+      const uint32_t s = dense.get(i);
+      if (!s) continue;
+      bits[i / 64] |= 1ULL << (i % 64);
+      uint64_t v = s - 1;
+      if (v >= kEscape) {
+        overflow_.push_back(Overflow(i, s));
+        v = kEscape;
+      }
+      seeds[rank / kSeedsPerWord] |= v << ((rank % kSeedsPerWord) * bits_per_seed);
+      rank++;
+    }
+    Point(w);
+  }
+
+  // read-only seeds over the words of another table kept elsewhere, e.g. in
+  // a mapped filter file (check them with ValidWords first); words must
+  // outlive the table. The few overflow seeds are copied
+  SparseSeedTable(const size_t num, const void *words, const Overflow *overflow, const size_t num_overflow)
+      : num_buckets_(num), overflow_(overflow, overflow + num_overflow) {
+    Point(words);
+  }
+
+  SparseSeedTable(const SparseSeedTable &other, const int pages)
+      : num_buckets_(other.num_buckets_), words_(other.WordBytes(), pages), overflow_(other.overflow_) {
+    if (words_.size()) memcpy(words_.data(), other.data_, words_.size());
+    Point(words_.data());
+  }
+
+  SparseSeedTable(const SparseSeedTable &other) : SparseSeedTable(other, other.words_.flags()) {}
+
+  SparseSeedTable &operator=(SparseSeedTable other) {
+    std::swap(num_buckets_, other.num_buckets_);
+    words_.Swap(other.words_);
+    std::swap(data_, other.data_);
+    overflow_.swap(other.overflow_);
+    Point(data_);
+    return *this;
+  }
+
+  size_t size() const { return num_buckets_; }
+  // read from the words, which a patch may change
+  size_t NumNonZero() const { return data_ ? data_[1] : 0; }
+
+  uint32_t get(const size_t i) const {
+    assert(i < num_buckets_);
+    const uint64_t w = bits_[i / 64];
+    const uint64_t bit = 1ULL << (i % 64);
+    if (!(w & bit)) return 0;
+    const uint64_t c = counts_[i / kBlockBits];
+    const size_t rank = (uint32_t)c + ((c >> (32 + 8 * (i % kBlockBits / 64))) & 0xff) +
+                        __builtin_popcountll(w & (bit - 1));
+    const uint32_t s = (seeds_[rank / kSeedsPerWord] >> ((rank % kSeedsPerWord) * bits_per_seed)) & kSeedMask;
+    if (s != kEscape) return s + 1;
+    auto it = std::lower_bound(overflow_.begin(), overflow_.end(), i, OverflowLess);
+    assert(it != overflow_.end() && it->first == i);
+    return it->second;
+  }
+
+  // the packed seed sits at a place only the rank tells, so only the bit and
+  // the count word of bucket i are pulled in ahead of a get(i)
+  void prefetch(const size_t i) const {
+    __builtin_prefetch(&bits_[i / 64]);
+    __builtin_prefetch(&counts_[i / kBlockBits]);
+  }
+
+  // whether bytes of words (from a filter file) hold seeds of num buckets
+  static bool ValidWords(const size_t num, const void *words, const size_t bytes) {
+    if (bytes < sizeof(uint64_t) * kHeaderWords) return false;
+    const uint64_t *w = static_cast<const uint64_t *>(words);
+    return w[0] == num && w[1] <= num && bytes == WordBytes(num, w[1]);
+  }
+
+  const void *WordData() const { return data_; }
+  // for a patch, which only applies between tables of the same WordBytes()
+  void *WordData() { return const_cast<uint64_t *>(data_); }
+  size_t WordBytes() const { return data_ ? WordBytes(num_buckets_, NumNonZero()) : 0; }
+  const Overflow *OverflowData() const { return overflow_.data(); }
+  size_t NumOverflow() const { return overflow_.size(); }
+
+  void SetOverflow(const Overflow *overflow, const size_t num_overflow) {
+    overflow_.assign(overflow, overflow + num_overflow);
+  }
+
+  size_t SizeInBytes() const {
+    return WordBytes() + sizeof(Overflow) * overflow_.size();
+  }
+
+  std::string Info() const {
+    std::stringstream ss;
+    ss << "SparseSeedTable with seed size: " << bits_per_seed << " bits, "
+       << NumNonZero() << " of " << num_buckets_ << " buckets rehashed, "
+       << overflow_.size() << " overflow seeds\n";
+    return ss.str();
+  }
+};
+}  // namespace cuckoofilter
+
+#endif  // CUCKOO_FILTER_SPARSE_SEED_TABLE_H_
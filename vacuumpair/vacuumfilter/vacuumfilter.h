@@ -3,21 +3,46 @@
 
 #include <assert.h>
 #include <algorithm>
+#include <memory>
+#include <string>
+#include <type_traits>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
 
 #include "debug.h"
+#include "filterfile.h"
 #include "hashutil.h"
 #include "packedtable.h"
 #include "printutil.h"
+#include "rangecoder.h"
+#include "seededtable.h"
+#include "seedtable.h"
 #include "singletable.h"
+#include "sparseseedtable.h"
 
 #define ROUNDDOWN(a, b) ((a) - ((a) % (b)))
 #define ROUNDUP(a, b) ROUNDDOWN((a) + (b - 1), b)
 //const int big_seg = 262144;
 const int AR = 4;
 const int BATCH_SIZE = 128;
+// buckets per block in a blocked filter: 8 SeededTable buckets fill one 64-byte cache line
+const int BLOCK_BUCKETS = 8;
 
 namespace cuckoofilter
 {
+  // blocked: the bucket that stands in for bucket i of a key once both of its buckets are full, at
+  // the same offset in a second block picked by the key. A key is only ever stored there while
+  // both of its own buckets are full, so a lookup only reads the second block (one more cache
+  // line) for such keys. Shared by the hashtable that places the keys and the filter
+  inline size_t SpillBucket(const size_t i, const uint64_t key, const size_t num_buckets)
+  {
+    const uint64_t blocks = num_buckets / BLOCK_BUCKETS;
+    const uint64_t h = (key * 0x9e3779b97f4a7c15ULL) >> 32;
+    const uint64_t block = i / BLOCK_BUCKETS + 1 + ((h * (blocks - 1)) >> 32); // never i's own block
+    return block % blocks * BLOCK_BUCKETS + i % BLOCK_BUCKETS;
+  }
+
   // status returned by a cuckoo filter operation
 
   // solve equation : 1 + x(logc - logx + 1) - c = 0
@@ -92,9 +117,12 @@ namespace cuckoofilter
   //   bits_per_item: how many bits each item is hashed into
   //   TableType: the storage of table, SingleTable by default, and
   // PackedTable to enable semi-sorting
+  //   SeedsType: storage of the bucket seeds, SeedTable by default, and
+  // SparseSeedTable to keep only the non-zero ones
   template <typename ItemType, size_t bits_per_item,
             typename HashFamily = TwoIndependentMultiplyShift,
-            template <size_t> class TableType = SingleTable>
+            template <size_t> class TableType = SingleTable,
+            typename SeedsType = SeedTable<>>
   class VacuumFilter
   {
     // Storage of items
@@ -117,10 +145,152 @@ namespace cuckoofilter
 
     HashFamily hasher_;
 
-    std::vector<uint8_t> seeds_;
+    // bucket seeds, left empty when the table keeps them in its buckets
+    SeedsType seeds_;
 
     int big_seg;
     int len[AR];
+    // 1 in a blocked filter, where an alt offset of 0 would leave an item only one bucket
+    int nonzero_alt_ = 0;
+
+    // the file the table and seeds are read from in a mapped filter (Map), else null
+    std::unique_ptr<MappedFile> file_;
+
+    typedef std::integral_constant<bool, TableType<bits_per_item>::kSeedsInBuckets> SeedsInTable;
+
+    inline uint32_t BucketSeed(const size_t i, std::false_type) const { return seeds_.get(i); }
+    inline uint32_t BucketSeed(const size_t i, std::true_type) const { return table_->ReadSeed(i); }
+    inline uint32_t BucketSeed(const size_t i) const { return BucketSeed(i, SeedsInTable()); }
+
+    // with seeds in the table, the seed comes in with its bucket
+    inline void PrefetchSeed(const size_t i, std::false_type) const { seeds_.prefetch(i); }
+    inline void PrefetchSeed(const size_t i, std::true_type) const { table_->PrefetchBucket(i); }
+    inline void PrefetchSeed(const size_t i) const { PrefetchSeed(i, SeedsInTable()); }
+
+    // blocked: whether every slot of buckets i1 and i2 is taken (tag 0 marks an empty slot), only
+    // then can a key of these buckets be in its spill buckets (SpillBucket)
+    inline bool Spills(const size_t i1, const size_t i2) const
+    {
+      return !table_->FindTagInBucket(i1, 0) && !table_->FindTagInBucket(i2, 0);
+    }
+
+    // blocked: whether item is in the spill buckets standing in for i1 and i2
+    inline bool FindInSpill(const ItemType &item, const size_t i1, const size_t i2) const
+    {
+      const size_t s1 = SpillBucket(i1, item, table_->NumBuckets());
+      const size_t s2 = SpillBucket(i2, item, table_->NumBuckets());
+      return table_->FindTagInBucket(s1, TagHash(hasher_(item, BucketSeed(s1)))) ||
+             table_->FindTagInBucket(s2, TagHash(hasher_(item, BucketSeed(s2))));
+    }
+
+    // seeds into / out of a filter file (filterfile.h): next to the table, or the overflow of a
+    // SeededTable whose buckets already hold the seeds
+    void SaveSeeds(FilterFileWriter &w, std::false_type) const
+    {
+      w.AddSection(kSectionSeeds, seeds_.WordData(), seeds_.WordBytes());
+      w.AddSection(kSectionSeedOverflow, seeds_.OverflowData(), sizeof(typename SeedsType::Overflow) * seeds_.NumOverflow());
+    }
+    void SaveSeeds(FilterFileWriter &w, std::true_type) const
+    {
+      w.AddSection(kSectionTableOverflow, table_->OverflowData(), sizeof(typename TableType<bits_per_item>::Overflow) * table_->NumOverflow());
+    }
+
+    void MapTable(const FileHeader &h, std::false_type)
+    {
+      const FileSectionEntry &s = h.sections[kSectionSeeds];
+      const FileSectionEntry &o = h.sections[kSectionSeedOverflow];
+      typedef typename SeedsType::Overflow Overflow;
+      if (!SeedsType::ValidWords(h.num_buckets, file_->Section(kSectionSeeds), s.bytes) ||
+          o.bytes % sizeof(Overflow))
+        throw std::runtime_error("filter file with seeds of another size");
+      table_ = new TableType<bits_per_item>(h.num_buckets, file_->Section(kSectionTable));
+      seeds_ = SeedsType(h.num_buckets, file_->Section(kSectionSeeds),
+                         static_cast<const Overflow *>(file_->Section(kSectionSeedOverflow)), o.bytes / sizeof(Overflow));
+    }
+    void MapTable(const FileHeader &h, std::true_type)
+    {
+      typedef typename TableType<bits_per_item>::Overflow Overflow;
+      const FileSectionEntry &o = h.sections[kSectionTableOverflow];
+      if (o.bytes % sizeof(Overflow))
+        throw std::runtime_error("filter file with seeds of another size");
+      table_ = new TableType<bits_per_item>(h.num_buckets, file_->Section(kSectionTable),
+                                            static_cast<const Overflow *>(file_->Section(kSectionTableOverflow)),
+                                            o.bytes / sizeof(Overflow));
+    }
+
+    // filter read in place from a filter file written by Save
+    explicit VacuumFilter(std::unique_ptr<MappedFile> file);
+
+    // overflow seeds kept by the table (SeededTable), none otherwise
+    const SeedTable<>::Overflow *TableOverflow(size_t &n, std::false_type) const
+    {
+      n = 0;
+      return nullptr;
+    }
+    const SeedTable<>::Overflow *TableOverflow(size_t &n, std::true_type) const
+    {
+      n = table_->NumOverflow();
+      return table_->OverflowData();
+    }
+    // the overflow seeds of the table into a patch; a table without them writes nothing, so
+    // fwrite never sees a null pointer
+    bool WriteTableOverflow(FILE *, std::false_type) const { return true; }
+    bool WriteTableOverflow(FILE *f, std::true_type) const
+    {
+      return fwrite(table_->OverflowData(), sizeof(SeedTable<>::Overflow), table_->NumOverflow(), f) == table_->NumOverflow();
+    }
+
+    void SetTableOverflow(const SeedTable<>::Overflow *, size_t n, std::false_type)
+    {
+      if (n)
+        throw std::runtime_error("patch with overflow seeds for a table without them");
+    }
+    void SetTableOverflow(const SeedTable<>::Overflow *o, size_t n, std::true_type) { table_->SetOverflow(o, n); }
+
+    // digest of everything a patch changes: tags, seeds, overflow seeds and the item count
+    uint64_t Digest() const
+    {
+      size_t nt;
+      const SeedTable<>::Overflow *t = TableOverflow(nt, SeedsInTable());
+      uint64_t h = DigestBytes(table_->Data(), table_->DataBytes(), num_items_);
+      h = DigestBytes(seeds_.WordData(), seeds_.WordBytes(), h);
+      h = DigestBytes(t, nt * sizeof(SeedTable<>::Overflow), h);
+      return DigestBytes(seeds_.OverflowData(), seeds_.NumOverflow() * sizeof(SeedTable<>::Overflow), h);
+    }
+
+    // header of a filter file for this filter, and the check that one is for this kind of filter
+    FileHeader FilterHeader() const;
+    static void CheckFilterHeader(const FileHeader &h);
+
+    // empty filter with the geometry of h and its table allocated, for LoadCompressed
+    VacuumFilter(const FileHeader &h, const HashFamily &hasher, int pages);
+
+    // contexts of the bits SaveCompressed codes
+    struct CompressModels
+    {
+      BitModel seed_nonzero[2]; // by whether the bucket before had a seed
+      BitModel seed_bits[16];   // bit tree of seed - 1, 15 escapes to 32 direct bits
+      BitModel slot_used[4][2]; // by slot and whether the slot before was empty
+    };
+
+    void EncodeBucket(RangeEncoder &e, CompressModels &m, size_t i, uint32_t &prev_seed) const;
+    // decodes bucket i into the table, its seed into dense (or the table when it keeps the seeds)
+    void DecodeBucket(RangeDecoder &d, CompressModels &m, size_t i, uint32_t &prev_seed, SeedTable<SeedsType::kBitsPerSeed> &dense);
+
+    inline void StoreSeed(size_t i, uint32_t s, SeedTable<SeedsType::kBitsPerSeed> &dense, std::false_type) { dense.set(i, s); }
+    inline void StoreSeed(size_t i, uint32_t s, SeedTable<SeedsType::kBitsPerSeed> &, std::true_type) { table_->WriteSeed(i, s); }
+
+    // decoded seeds: a SeedTable is taken over as it is, other seed tables are built from it
+    void AdoptSeeds(SeedTable<SeedsType::kBitsPerSeed> &&dense, int, std::true_type) { seeds_ = std::move(dense); }
+    void AdoptSeeds(SeedTable<SeedsType::kBitsPerSeed> &&dense, int pages, std::false_type) { seeds_ = SeedsType(dense, pages); }
+
+    inline void LoadSeeds(std::false_type) {}
+    inline void LoadSeeds(std::true_type)
+    {
+      for (size_t i = 0; i < seeds_.size(); i++)
+        table_->WriteSeed(i, seeds_.get(i));
+      seeds_ = SeedsType();
+    }
 
     inline size_t IndexHash(const ItemType &item) const
     {
@@ -140,7 +310,7 @@ namespace cuckoofilter
                                      uint32_t *tag) const
     {
       *index = IndexHash(item);
-      const uint64_t hash = hasher_(item, seeds_.at(*index));
+      const uint64_t hash = hasher_(item, BucketSeed(*index));
       *tag = TagHash(hash);
     }
 
@@ -150,7 +320,7 @@ namespace cuckoofilter
     {
       // *i1 = IndexHash(item); // original: hash >> 32
       *i2 = AltIndex(i1, item);
-      const uint64_t hash2 = hasher_(item, seeds_.at(*i2));
+      const uint64_t hash2 = hasher_(item, BucketSeed(*i2));
       *tag2 = TagHash(hash2);
     }
 
@@ -161,13 +331,50 @@ namespace cuckoofilter
       // now doing a quick-n-dirty way:
       // 0x5bd1e995 is the hash constant from MurmurHash2
       //return IndexHash((uint32_t)(index ^ (tag * 0x5bd1e995)));
-      int t = item * 0x5bd1e995;
+      int t = item * kAltMultiplier;
       int seg = len[item & (AR - 1)];
       t = t & seg;
       //t += (t == 0);
+      t += nonzero_alt_ & (t == 0); // blocked: never map an item to a single bucket
       return index ^ t;
     }
 
+    // IndexHash and AltIndex(i1, item) of n keys. With AVX2 and 64-bit keys, four keys are
+    // hashed per instruction: a 32x32 multiply gives IndexHash, a 32-bit multiply, a
+    // permute of len by the low key bits and an and/xor give AltIndex
+    inline void BatchIndices(const ItemType *key, size_t *i1, size_t *i2, int n) const
+    {
+      int j = 0;
+#ifdef __AVX2__
+      if (AR == 4 && std::is_integral<ItemType>::value && sizeof(ItemType) == 8 && sizeof(size_t) == 8 &&
+          table_->NumBuckets() <= 0xffffffffULL)
+      {
+        const __m256i num_buckets = _mm256_set1_epi64x(table_->NumBuckets());
+        const __m256i murmur = _mm256_set1_epi32(kAltMultiplier);
+        const __m256i low32 = _mm256_set1_epi64x(0xffffffffULL);
+        const __m256i ar_mask = _mm256_set1_epi64x(AR - 1);
+        const __m256i lens = _mm256_setr_epi32(len[0], len[1], len[2], len[3], 0, 0, 0, 0);
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i nonzero = _mm256_set1_epi64x(nonzero_alt_);
+        for (; j + 4 <= n; j += 4)
+        {
+          const __m256i item = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(key + j));
+          const __m256i idx = _mm256_srli_epi64(_mm256_mul_epu32(_mm256_srli_epi64(item, 32), num_buckets), 32);
+          const __m256i seg = _mm256_permutevar8x32_epi32(lens, _mm256_and_si256(item, ar_mask));
+          __m256i t = _mm256_and_si256(_mm256_and_si256(_mm256_mullo_epi32(item, murmur), seg), low32);
+          t = _mm256_add_epi64(t, _mm256_and_si256(_mm256_cmpeq_epi64(t, zero), nonzero));
+          _mm256_storeu_si256(reinterpret_cast<__m256i *>(i1 + j), idx);
+          _mm256_storeu_si256(reinterpret_cast<__m256i *>(i2 + j), _mm256_xor_si256(idx, t));
+        }
+      }
+#endif
+      for (; j < n; j++)
+      {
+        i1[j] = IndexHash(key[j]);
+        i2[j] = AltIndex(i1[j], key[j]);
+      }
+    }
+
     Status AddImpl(const size_t i, const uint32_t tag);
 
   public:
@@ -246,7 +453,13 @@ namespace cuckoofilter
     }
     
     // modified constructor
-    explicit VacuumFilter(const size_t max_num_keys, const std::vector<uint8_t> &seeds = std::vector<uint8_t>(), bool aligned = false, bool _packed = false) : num_items_(0), seeds_(seeds), victim_(), hasher_()
+    // blocked: every alt range is one block of BLOCK_BUCKETS buckets, so both buckets of an item
+    // (and with SeededTable, their seeds) share a cache line, unless both were full and the item
+    // went to its spill buckets (SpillBucket). Must match the hashtable the seeds came from, which
+    // also sized the table and placed the items; a blocked filter is filled with CopyBucket.
+    // pages: PageFlags (pagealloc.h) for the table and the seeds, e.g. kHugePages for big filters
+    explicit VacuumFilter(const size_t max_num_keys, const SeedTable<> &seeds = SeedTable<>(), bool aligned = false, bool _packed = false, bool blocked = false,
+                          int pages = kNormalPages) : num_items_(0), seeds_(seeds, pages), victim_(), hasher_()
     {
 
       // std::cout << "good" << std::endl;
@@ -256,18 +469,29 @@ namespace cuckoofilter
       // size_t num_buckets;
       packed = _packed;
 
-      big_seg = 0;
-      big_seg = std::max(big_seg, proper_alt_range(max_num_keys / assoc, 0, len));
-      big_seg = std::max(big_seg, 1024);
-      // num_buckets = ROUNDUP(int(max_num_keys / assoc), big_seg);
+      if (blocked)
+      {
+        assert(num_buckets % BLOCK_BUCKETS == 0);
+        big_seg = BLOCK_BUCKETS - 1;
+        for (int i = 0; i < AR; i++)
+          len[i] = BLOCK_BUCKETS - 1;
+        nonzero_alt_ = 1;
+      }
+      else
+      {
+        big_seg = 0;
+        big_seg = std::max(big_seg, proper_alt_range(max_num_keys / assoc, 0, len));
+        big_seg = std::max(big_seg, 1024);
+        // num_buckets = ROUNDUP(int(max_num_keys / assoc), big_seg);
 
-      big_seg--;
-      len[0] = big_seg;
-      for (int i = 1; i < AR; i++) // sets all alt ranges
-        len[i] = proper_alt_range(num_buckets, i, len) - 1;
-      len[AR - 1] = (len[AR - 1] + 1) * 2 - 1;
-      // if (AR == 1)
-      //   num_buckets = ROUNDUP(int(max_num_keys / assoc), len[0] + 1);
+        big_seg--;
+        len[0] = big_seg;
+        for (int i = 1; i < AR; i++) // sets all alt ranges
+          len[i] = proper_alt_range(num_buckets, i, len) - 1;
+        len[AR - 1] = (len[AR - 1] + 1) * 2 - 1;
+        // if (AR == 1)
+        //   num_buckets = ROUNDUP(int(max_num_keys / assoc), len[0] + 1);
+      }
 
       // assert(seeds_.size() == num_buckets); // double-check calculations match
       victim_.used = false;
@@ -279,9 +503,24 @@ namespace cuckoofilter
         std::cout << len[i] + 1 << ", ";
       std::cout << std::endl;
 
-      table_ = new TableType<bits_per_item>(num_buckets);
+      table_ = new TableType<bits_per_item>(num_buckets, pages);
+      LoadSeeds(SeedsInTable());
+    }
+
+    // multiplier of AltIndex (from MurmurHash2), recorded in filter files
+    static const uint32_t kAltMultiplier = 0x5bd1e995;
+
+    // deep copy of the table and seeds, e.g. one replica per NUMA node (queryservice.hh)
+    VacuumFilter(const VacuumFilter &other)
+        : table_(new TableType<bits_per_item>(*other.table_)), num_items_(other.num_items_), max_2_power(other.max_2_power),
+          alt_len(other.alt_len), packed(other.packed), victim_(other.victim_), hasher_(other.hasher_), seeds_(other.seeds_),
+          big_seg(other.big_seg), nonzero_alt_(other.nonzero_alt_)
+    {
+      std::copy(other.len, other.len + AR, len);
     }
 
+    VacuumFilter &operator=(const VacuumFilter &) = delete;
+
     ~VacuumFilter() { delete table_; }
 
     // Add an item to the filter.
@@ -295,11 +534,20 @@ namespace cuckoofilter
     // Insert item to the filter at given bucket index and slot.
     Status CopyInsert(const uint32_t fp, size_t index, size_t slot);
 
+    // Insert the n fingerprints of a whole bucket at given bucket index.
+    Status CopyBucket(const uint32_t *fps, size_t index, size_t n);
+
     // Report if the item is inserted, with false positive rate.
     Status Contain(const ItemType &item) const;
 
-    // Report if the item is inserted, with false positive rate.
-    void Contain_many(const ItemType *item, bool *result, int key_n);
+    // Contain() of key_n items, result[i] is true iff Contain(item[i]) == Ok.
+    void Contain_many(const ItemType *item, bool *result, int key_n) const;
+
+    // Contain() of every item in [first, last), bit i of bitmap is set iff item first[i] is
+    // found. bitmap must hold (last - first + 63) / 64 words. Keeps kInFlight lookups going
+    // at once so their cache misses overlap.
+    template <int kInFlight = 16>
+    void Contain_stream(const ItemType *first, const ItemType *last, uint64_t *bitmap) const;
 
     // Report if the item is inserted, report bucket 1 or bucket 2
     uint32_t Contain_where(const ItemType &item) const;
@@ -312,6 +560,42 @@ namespace cuckoofilter
 
     size_t SeedTable_Size() const;
 
+    // writes the built filter to path (format in filterfile.h), replacing the file at once when
+    // it is done. Throws std::runtime_error on I/O errors
+    void Save(const std::string &path) const;
+
+    // filter over the file at path written by Save, with the same template arguments. Table and
+    // seeds are used in place from a read-only mapping instead of being read in, so only lookups
+    // (Contain and friends, Info) may be used, and a copy is an ordinary filter in memory.
+    // populate: read the whole file in now rather than on first touch. verify: check the CRCs of
+    // the header and every section first (MappedFile::Verify, one parallel pass over the file),
+    // so a corrupt generation is never returned; without it only the header is checked. Throws
+    // std::runtime_error for a file that is missing, corrupt or holds another kind of filter
+    static VacuumFilter *Map(const std::string &path, bool populate = false, bool verify = true);
+
+    // writes to patch_path the patch from the filter saved at from_path to the one saved at
+    // to_path (format in filterfile.h) and returns its size in bytes. Both have to be built with
+    // the same capacity: when the table geometry differs there is no patch, std::runtime_error is
+    // thrown and the new file has to be sent whole
+    static size_t Diff(const std::string &from_path, const std::string &to_path, const std::string &patch_path);
+
+    // turns this filter into the patch's target in place, in time proportional to the patch. A
+    // mapped filter gets private copies of the pages written, its file is left alone. verify: make
+    // sure this is the patch's base before and its target after (one pass over the filter), and
+    // undo the patch when it is not. Throws std::runtime_error for a patch made for another filter,
+    // which always leaves the filter as it was
+    void ApplyPatch(const std::string &patch_path, bool verify = true);
+
+    // writes the filter range coded for shipping (format in filterfile.h), a fraction of the
+    // Save size when slots are empty or most seeds are 0. Throws std::runtime_error on I/O errors
+    void SaveCompressed(const std::string &path) const;
+
+    // filter decoded from a file written by SaveCompressed, with the same template arguments, read
+    // in one pass straight into a new table allocated according to pages (PageFlags); in may be a
+    // pipe. Throws std::runtime_error for input that is truncated, corrupt or another kind of filter
+    static VacuumFilter *LoadCompressed(const std::string &path, int pages = kNormalPages);
+    static VacuumFilter *LoadCompressed(FILE *in, int pages = kNormalPages);
+
     /* methods for providing stats  */
     // summary infomation
     std::string Info() const;
@@ -329,8 +613,8 @@ namespace cuckoofilter
   };
 
   template <typename ItemType, size_t bits_per_item, typename HashFamily,
-            template <size_t> class TableType>
-  Status VacuumFilter<ItemType, bits_per_item, HashFamily, TableType>::Add(
+            template <size_t> class TableType, typename SeedsType>
+  Status VacuumFilter<ItemType, bits_per_item, HashFamily, TableType, SeedsType>::Add(
       const ItemType &item)
   {
     size_t i;
@@ -346,8 +630,8 @@ namespace cuckoofilter
   }
 
   template <typename ItemType, size_t bits_per_item, typename HashFamily,
-            template <size_t> class TableType>
-  void VacuumFilter<ItemType, bits_per_item, HashFamily, TableType>::Add_many(
+            template <size_t> class TableType, typename SeedsType>
+  void VacuumFilter<ItemType, bits_per_item, HashFamily, TableType, SeedsType>::Add_many(
       const ItemType *key, bool *result, int key_n)
   {
 
@@ -381,8 +665,8 @@ namespace cuckoofilter
   }
 
   template <typename ItemType, size_t bits_per_item, typename HashFamily,
-            template <size_t> class TableType>
-  bool VacuumFilter<ItemType, bits_per_item, HashFamily, TableType>::evict(
+            template <size_t> class TableType, typename SeedsType>
+  bool VacuumFilter<ItemType, bits_per_item, HashFamily, TableType, SeedsType>::evict(
       const size_t i, const uint32_t tag)
   {
     size_t curindex = i;
@@ -435,8 +719,8 @@ namespace cuckoofilter
   }
 
   template <typename ItemType, size_t bits_per_item, typename HashFamily,
-            template <size_t> class TableType>
-  Status VacuumFilter<ItemType, bits_per_item, HashFamily, TableType>::AddImpl(
+            template <size_t> class TableType, typename SeedsType>
+  Status VacuumFilter<ItemType, bits_per_item, HashFamily, TableType, SeedsType>::AddImpl(
       const size_t i, const uint32_t tag)
   {
     size_t curindex = i;
@@ -498,8 +782,8 @@ namespace cuckoofilter
   }
 
   template <typename ItemType, size_t bits_per_item, typename HashFamily,
-          template <size_t> class TableType>
-Status VacuumFilter<ItemType, bits_per_item, HashFamily, TableType>::CopyInsert(
+          template <size_t> class TableType, typename SeedsType>
+Status VacuumFilter<ItemType, bits_per_item, HashFamily, TableType, SeedsType>::CopyInsert(
     const uint32_t fp, const size_t index, const size_t slot) {
   if (table_->CopyTagToBucket(index, slot, fp)) {
     // table_->WriteTag(index, slot, fp);
@@ -511,8 +795,23 @@ Status VacuumFilter<ItemType, bits_per_item, HashFamily, TableType>::CopyInsert(
 }
 
   template <typename ItemType, size_t bits_per_item, typename HashFamily,
-            template <size_t> class TableType>
-  Status VacuumFilter<ItemType, bits_per_item, HashFamily, TableType>::Contain(
+            template <size_t> class TableType, typename SeedsType>
+  Status VacuumFilter<ItemType, bits_per_item, HashFamily, TableType, SeedsType>::CopyBucket(
+      const uint32_t *fps, const size_t index, const size_t n)
+  {
+    if (n > 4)
+      return NotSupported;
+    uint32_t tags[4] = {0, 0, 0, 0};
+    for (size_t j = 0; j < n; j++)
+      tags[j] = fps[j];
+    table_->CopyBucket(index, tags);
+    num_items_ += n;
+    return Ok;
+  }
+
+  template <typename ItemType, size_t bits_per_item, typename HashFamily,
+            template <size_t> class TableType, typename SeedsType>
+  Status VacuumFilter<ItemType, bits_per_item, HashFamily, TableType, SeedsType>::Contain(
       const ItemType &key) const
   {
     // bool found = false;
@@ -530,39 +829,127 @@ Status VacuumFilter<ItemType, bits_per_item, HashFamily, TableType>::CopyInsert(
     if (table_->FindTagInBucket(i2, tag2))
       return Ok;
 
+    if (nonzero_alt_ && Spills(i1, i2) && FindInSpill(key, i1, i2))
+      return Ok;
+
     return NotFound;
   }
 
   template <typename ItemType, size_t bits_per_item, typename HashFamily,
-            template <size_t> class TableType>
-  void VacuumFilter<ItemType, bits_per_item, HashFamily, TableType>::Contain_many(
-      const ItemType *key, bool *result, int key_n)
+            template <size_t> class TableType, typename SeedsType>
+  void VacuumFilter<ItemType, bits_per_item, HashFamily, TableType, SeedsType>::Contain_many(
+      const ItemType *key, bool *result, int key_n) const
   {
-
-    size_t bucket_position[BATCH_SIZE];
-    uint32_t tag[BATCH_SIZE];
-    bool tmp_result[BATCH_SIZE];
+    // staged per batch like Add_many: indices of all keys first, then their seeds and tags,
+    // then the buckets, each stage prefetching what the next one reads
+    // blocked: keys missed in two full buckets go through the same stages again for their spill
+    // buckets, after the rest of the batch
+    size_t i1[BATCH_SIZE];
+    size_t i2[BATCH_SIZE];
+    uint32_t tag1[BATCH_SIZE];
+    uint32_t tag2[BATCH_SIZE];
+    int spill[BATCH_SIZE];
 
     for (int i = 0; i < key_n; i += BATCH_SIZE)
     {
-      memset(tmp_result, false, BATCH_SIZE);
-      for (int j = 0; j < BATCH_SIZE; j++)
-        GenerateIndexTagHash(key[i + j], &bucket_position[j], &tag[j]);
-      for (int j = 0; j < BATCH_SIZE; j++)
-        tmp_result[j] = table_->FindTagInBucket(bucket_position[j], tag[j]);
-      for (int j = 0; j < BATCH_SIZE; j++)
-        bucket_position[j] = AltIndex(bucket_position[j], tag[j]);
-      for (int j = 0; j < BATCH_SIZE; j++)
-        if (tmp_result[j] == false)
-          tmp_result[j] = table_->FindTagInBucket(bucket_position[j], tag[j]);
+      int up = std::min(BATCH_SIZE, key_n - i);
+      BatchIndices(&key[i], i1, i2, up);
+      for (int j = 0; j < up; j++)
+      {
+        PrefetchSeed(i1[j]);
+        PrefetchSeed(i2[j]);
+      }
+      for (int j = 0; j < up; j++)
+      {
+        tag1[j] = TagHash(hasher_(key[i + j], BucketSeed(i1[j])));
+        tag2[j] = TagHash(hasher_(key[i + j], BucketSeed(i2[j])));
+        table_->PrefetchBucket(i1[j]);
+        table_->PrefetchBucket(i2[j]);
+      }
+      int spills = 0;
+      for (int j = 0; j < up; j++)
+      {
+        result[i + j] = table_->FindTagInBucket(i1[j], tag1[j]) || table_->FindTagInBucket(i2[j], tag2[j]);
+        if (nonzero_alt_ && !result[i + j] && Spills(i1[j], i2[j]))
+          spill[spills++] = j;
+      }
+      if (!spills)
+        continue;
+      for (int k = 0; k < spills; k++)
+      {
+        const int j = spill[k];
+        i1[j] = SpillBucket(i1[j], key[i + j], table_->NumBuckets());
+        i2[j] = SpillBucket(i2[j], key[i + j], table_->NumBuckets());
+        PrefetchSeed(i1[j]);
+        PrefetchSeed(i2[j]);
+        table_->PrefetchBucket(i1[j]);
+        table_->PrefetchBucket(i2[j]);
+      }
+      for (int k = 0; k < spills; k++)
+      {
+        const int j = spill[k];
+        result[i + j] = table_->FindTagInBucket(i1[j], TagHash(hasher_(key[i + j], BucketSeed(i1[j])))) ||
+                        table_->FindTagInBucket(i2[j], TagHash(hasher_(key[i + j], BucketSeed(i2[j]))));
+      }
+    }
+  }
 
-      memcpy(&result[i], tmp_result, BATCH_SIZE);
+  template <typename ItemType, size_t bits_per_item, typename HashFamily,
+            template <size_t> class TableType, typename SeedsType>
+  template <int kInFlight>
+  void VacuumFilter<ItemType, bits_per_item, HashFamily, TableType, SeedsType>::Contain_stream(
+      const ItemType *first, const ItemType *last, uint64_t *bitmap) const
+  {
+    static_assert(kInFlight > 0 && (kInFlight & (kInFlight - 1)) == 0, "kInFlight must be a power of two");
+
+    // asynchronous memory access chaining over a ring of kInFlight lookups: issuing lookup k
+    // computes both buckets (they only depend on the key) and prefetches both seeds and both
+    // buckets, completing it kInFlight lookups later hashes the seeded tags and probes, by then
+    // all four lines are in cache. Lookup k and lookup k - kInFlight share ring slot k % kInFlight
+    struct Lookup
+    {
+      size_t i1, i2;
+    };
+    Lookup ring[kInFlight];
+    const size_t n = last - first;
+
+    std::fill(bitmap, bitmap + (n + 63) / 64, 0);
+
+    auto issue = [&](const size_t k) {
+      Lookup &l = ring[k & (kInFlight - 1)];
+      l.i1 = IndexHash(first[k]);
+      l.i2 = AltIndex(l.i1, first[k]);
+      PrefetchSeed(l.i1);
+      PrefetchSeed(l.i2);
+      table_->PrefetchBucket(l.i1);
+      table_->PrefetchBucket(l.i2);
+    };
+    auto complete = [&](const size_t k) {
+      const Lookup &l = ring[k & (kInFlight - 1)];
+      // both buckets are probed unconditionally, a hit in i1 is too unpredictable to branch on.
+      // Two full buckets of a blocked filter send the key on to its spill buckets, not prefetched
+      bool found = table_->FindTagInBucket(l.i1, TagHash(hasher_(first[k], BucketSeed(l.i1)))) |
+                   table_->FindTagInBucket(l.i2, TagHash(hasher_(first[k], BucketSeed(l.i2))));
+      if (nonzero_alt_ && !found && Spills(l.i1, l.i2))
+        found = FindInSpill(first[k], l.i1, l.i2);
+      bitmap[k >> 6] |= uint64_t(found) << (k & 63);
+    };
+
+    const size_t warmup = std::min<size_t>(kInFlight, n);
+    for (size_t k = 0; k < warmup; k++)
+      issue(k);
+    for (size_t k = warmup; k < n; k++)
+    {
+      complete(k - kInFlight);
+      issue(k);
     }
+    for (size_t k = n - warmup; k < n; k++)
+      complete(k);
   }
 
   template <typename ItemType, size_t bits_per_item, typename HashFamily,
-            template <size_t> class TableType>
-  uint32_t VacuumFilter<ItemType, bits_per_item, HashFamily, TableType>::Contain_where(
+            template <size_t> class TableType, typename SeedsType>
+  uint32_t VacuumFilter<ItemType, bits_per_item, HashFamily, TableType, SeedsType>::Contain_where(
       const ItemType &key) const
   {
     bool found = false;
@@ -583,8 +970,8 @@ Status VacuumFilter<ItemType, bits_per_item, HashFamily, TableType>::CopyInsert(
   }
 
   template <typename ItemType, size_t bits_per_item, typename HashFamily,
-            template <size_t> class TableType>
-  void VacuumFilter<ItemType, bits_per_item, HashFamily, TableType>::Delete_many(
+            template <size_t> class TableType, typename SeedsType>
+  void VacuumFilter<ItemType, bits_per_item, HashFamily, TableType, SeedsType>::Delete_many(
       const ItemType *key, bool *result, int key_n)
   {
 
@@ -612,8 +999,8 @@ Status VacuumFilter<ItemType, bits_per_item, HashFamily, TableType>::CopyInsert(
   }
 
   template <typename ItemType, size_t bits_per_item, typename HashFamily,
-            template <size_t> class TableType>
-  Status VacuumFilter<ItemType, bits_per_item, HashFamily, TableType>::Delete(
+            template <size_t> class TableType, typename SeedsType>
+  Status VacuumFilter<ItemType, bits_per_item, HashFamily, TableType, SeedsType>::Delete(
       const ItemType &key)
   {
     size_t i1, i2;
@@ -655,23 +1042,488 @@ Status VacuumFilter<ItemType, bits_per_item, HashFamily, TableType>::CopyInsert(
   }
 
   template <typename ItemType, size_t bits_per_item, typename HashFamily,
-          template <size_t> class TableType>
-size_t VacuumFilter<ItemType, bits_per_item, HashFamily, TableType>::SeedTable_Size() const {
-  return sizeof(std::vector<uint8_t>) + (sizeof(uint8_t) * seeds_.size());
-  // sizeof(vector) = 24, sizeof(uint8_t) = 1, sizeof(int) = 4
+          template <size_t> class TableType, typename SeedsType>
+size_t VacuumFilter<ItemType, bits_per_item, HashFamily, TableType, SeedsType>::SeedTable_Size() const {
+  return seeds_.SizeInBytes();
 }
 
   template <typename ItemType, size_t bits_per_item, typename HashFamily,
-            template <size_t> class TableType>
-  std::string VacuumFilter<ItemType, bits_per_item, HashFamily, TableType>::Info() const
+            template <size_t> class TableType, typename SeedsType>
+  FileHeader VacuumFilter<ItemType, bits_per_item, HashFamily, TableType, SeedsType>::FilterHeader() const
+  {
+    static_assert(AR <= (int)kFileMaxAR, "too many alt ranges for a filter file");
+    FileHeader h;
+    memset(&h, 0, sizeof(h));
+    h.key_bytes = sizeof(ItemType);
+    h.bits_per_item = bits_per_item;
+    h.table_id = TableType<bits_per_item>::kTableId;
+    h.seeds_id = SeedsInTable::value ? 0 : SeedsType::kSeedsId;
+    h.hash_bytes = HashParamBytes<HashFamily>();
+    h.num_buckets = table_->NumBuckets();
+    h.num_items = num_items_;
+    h.ar = AR;
+    std::copy(len, len + AR, h.len);
+    h.big_seg = big_seg;
+    h.nonzero_alt = nonzero_alt_;
+    h.alt_multiplier = kAltMultiplier;
+    h.packed = packed;
+    h.hash_id = FileTypeId<HashFamily>();
+    return h;
+  }
+
+  template <typename ItemType, size_t bits_per_item, typename HashFamily,
+            template <size_t> class TableType, typename SeedsType>
+  void VacuumFilter<ItemType, bits_per_item, HashFamily, TableType, SeedsType>::CheckFilterHeader(const FileHeader &h)
+  {
+    if (h.key_bytes != sizeof(ItemType) || h.bits_per_item != bits_per_item ||
+        h.table_id != TableType<bits_per_item>::kTableId || h.hash_bytes != HashParamBytes<HashFamily>() ||
+        h.hash_id != FileTypeId<HashFamily>() || h.ar != AR || h.alt_multiplier != kAltMultiplier ||
+        h.seeds_id != (SeedsInTable::value ? 0 : SeedsType::kSeedsId))
+      throw std::runtime_error("filter file holds a filter of another type");
+  }
+
+  template <typename ItemType, size_t bits_per_item, typename HashFamily,
+            template <size_t> class TableType, typename SeedsType>
+  void VacuumFilter<ItemType, bits_per_item, HashFamily, TableType, SeedsType>::Save(const std::string &path) const
+  {
+    FilterFileWriter w(path, FilterHeader());
+    w.AddSection(kSectionTable, table_->Data(), table_->DataBytes());
+    SaveSeeds(w, SeedsInTable());
+    w.AddSection(kSectionHash, &hasher_, HashParamBytes<HashFamily>());
+    w.Finish();
+  }
+
+  template <typename ItemType, size_t bits_per_item, typename HashFamily,
+            template <size_t> class TableType, typename SeedsType>
+  VacuumFilter<ItemType, bits_per_item, HashFamily, TableType, SeedsType> *
+  VacuumFilter<ItemType, bits_per_item, HashFamily, TableType, SeedsType>::Map(const std::string &path, bool populate, bool verify)
+  {
+    std::unique_ptr<MappedFile> file(new MappedFile(path, populate));
+    if (verify)
+      file->Verify();
+    return new VacuumFilter(std::move(file));
+  }
+
+  template <typename ItemType, size_t bits_per_item, typename HashFamily,
+            template <size_t> class TableType, typename SeedsType>
+  VacuumFilter<ItemType, bits_per_item, HashFamily, TableType, SeedsType>::VacuumFilter(std::unique_ptr<MappedFile> file)
+      : table_(nullptr), num_items_(0), max_2_power(0), alt_len(0), packed(false), victim_(), hasher_(), file_(std::move(file))
+  {
+    const FileHeader &h = file_->Header();
+    CheckFilterHeader(h);
+    // the table computes its size from the bucket count, the file has to match it
+    TableType<bits_per_item> probe(h.num_buckets, file_->data());
+    if (h.sections[kSectionTable].bytes != probe.DataBytes() || h.sections[kSectionHash].bytes != HashParamBytes<HashFamily>())
+      throw std::runtime_error("filter file truncated or corrupt");
+
+    num_items_ = h.num_items;
+    packed = h.packed;
+    victim_.used = false;
+    if (HashParamBytes<HashFamily>())
+      memcpy(static_cast<void *>(&hasher_), file_->Section(kSectionHash), HashParamBytes<HashFamily>());
+    std::copy(h.len, h.len + AR, len);
+    big_seg = h.big_seg;
+    nonzero_alt_ = h.nonzero_alt;
+    MapTable(h, SeedsInTable());
+  }
+
+  template <typename ItemType, size_t bits_per_item, typename HashFamily,
+            template <size_t> class TableType, typename SeedsType>
+  size_t VacuumFilter<ItemType, bits_per_item, HashFamily, TableType, SeedsType>::Diff(
+      const std::string &from_path, const std::string &to_path, const std::string &patch_path)
+  {
+    std::unique_ptr<VacuumFilter> a(Map(from_path)), b(Map(to_path));
+    // same geometry: headers equal up to the item count and where the sections are
+    FileHeader ha = a->file_->Header(), hb = b->file_->Header();
+    ha.num_items = hb.num_items = 0;
+    ha.header_crc = hb.header_crc = 0;
+    memset(ha.sections, 0, sizeof(ha.sections));
+    memset(hb.sections, 0, sizeof(hb.sections));
+    if (memcmp(&ha, &hb, sizeof(ha)) != 0 || memcmp(&a->hasher_, &b->hasher_, HashParamBytes<HashFamily>()) != 0 ||
+        a->seeds_.WordBytes() != b->seeds_.WordBytes())
+      throw std::runtime_error("filters of different geometry, no patch between them");
+
+    const char *x[2] = {static_cast<const char *>(a->table_->Data()), static_cast<const char *>(a->seeds_.WordData())};
+    const char *y[2] = {static_cast<const char *>(b->table_->Data()), static_cast<const char *>(b->seeds_.WordData())};
+    const size_t bytes[2] = {a->table_->DataBytes(), a->seeds_.WordBytes()};
+
+    std::vector<uint8_t> runs;
+    auto put = [&runs](uint64_t v) {
+      for (; v >= 0x80; v >>= 7)
+        runs.push_back(uint8_t(v) | 0x80);
+      runs.push_back(uint8_t(v));
+    };
+    uint64_t num_runs = 0, last_end = 0;
+    for (int r = 0; r < 2; r++)
+    {
+      const size_t n = bytes[r], words = (n + 7) / 8, base = r ? bytes[0] : 0;
+      auto differs = [&](size_t k) { return memcmp(x[r] + 8 * k, y[r] + 8 * k, std::min<size_t>(8, n - 8 * k)) != 0; };
+      for (size_t k = 0; k < words; k++)
+      {
+        if (!differs(k))
+          continue;
+        // extend over changed words and gaps too short to be worth a new run
+        size_t end = k + 1;
+        for (size_t j = end; j < words && (j - end) * 8 < kPatchJoin; j++)
+          if (differs(j))
+            end = j + 1;
+        const size_t from = 8 * k, to = std::min(n, 8 * end);
+        put(base + from - last_end);
+        put(to - from);
+        runs.insert(runs.end(), y[r] + from, y[r] + to);
+        last_end = base + to;
+        num_runs++;
+        k = end - 1;
+      }
+    }
+
+    PatchHeader p;
+    memset(&p, 0, sizeof(p));
+    memcpy(p.magic, kPatchMagic, sizeof(kPatchMagic));
+    p.version = kPatchVersion;
+    p.byte_order = kByteOrderMark;
+    p.header_bytes = sizeof(PatchHeader);
+    p.table_id = TableType<bits_per_item>::kTableId;
+    p.bits_per_item = bits_per_item;
+    p.seeds_id = hb.seeds_id;
+    p.num_buckets = b->table_->NumBuckets();
+    p.table_bytes = bytes[0];
+    p.seed_bytes = bytes[1];
+    p.base_digest = a->Digest();
+    p.target_digest = b->Digest();
+    p.num_items = b->num_items_;
+    b->TableOverflow(p.table_overflow, SeedsInTable());
+    p.seed_overflow = b->seeds_.NumOverflow();
+    p.num_runs = num_runs;
+    p.run_bytes = runs.size();
+
+    const std::string tmp = patch_path + ".tmp";
+    FILE *f = fopen(tmp.c_str(), "wb");
+    if (!f)
+      throw std::runtime_error("could not create patch " + tmp);
+    const size_t pair = sizeof(SeedTable<>::Overflow);
+    bool ok = fwrite(&p, sizeof(p), 1, f) == 1;
+    if (ok && p.table_overflow)
+      ok = b->WriteTableOverflow(f, SeedsInTable());
+    if (ok && p.seed_overflow)
+      ok = fwrite(b->seeds_.OverflowData(), pair, p.seed_overflow, f) == p.seed_overflow;
+    if (ok && !runs.empty())
+      ok = fwrite(runs.data(), 1, runs.size(), f) == runs.size();
+    // synced before the rename, as FilterFileWriter does
+    ok = ok && fflush(f) == 0 && fsync(fileno(f)) == 0;
+    ok = fclose(f) == 0 && ok;
+    if (!ok || rename(tmp.c_str(), patch_path.c_str()) != 0)
+    {
+      unlink(tmp.c_str());
+      throw std::runtime_error("could not write patch " + patch_path);
+    }
+    return sizeof(p) + pair * (p.table_overflow + p.seed_overflow) + runs.size();
+  }
+
+  template <typename ItemType, size_t bits_per_item, typename HashFamily,
+            template <size_t> class TableType, typename SeedsType>
+  void VacuumFilter<ItemType, bits_per_item, HashFamily, TableType, SeedsType>::ApplyPatch(const std::string &patch_path, bool verify)
+  {
+    MappedFile patch(patch_path);
+    if (patch.size() < sizeof(PatchHeader))
+      throw std::runtime_error("not a filter patch: " + patch_path);
+    const PatchHeader &p = *reinterpret_cast<const PatchHeader *>(patch.data());
+    const size_t pair = sizeof(SeedTable<>::Overflow);
+    if (memcmp(p.magic, kPatchMagic, sizeof(kPatchMagic)) != 0 || p.byte_order != kByteOrderMark ||
+        p.version != kPatchVersion || p.header_bytes != sizeof(PatchHeader) ||
+        p.table_overflow > patch.size() / pair || p.seed_overflow > patch.size() / pair ||
+        sizeof(PatchHeader) + pair * (p.table_overflow + p.seed_overflow) + p.run_bytes != patch.size())
+      throw std::runtime_error("not a filter patch or corrupt: " + patch_path);
+    if (p.table_id != TableType<bits_per_item>::kTableId || p.bits_per_item != bits_per_item ||
+        p.num_buckets != table_->NumBuckets() || p.table_bytes != table_->DataBytes() ||
+        p.seed_bytes != seeds_.WordBytes())
+      throw std::runtime_error("patch " + patch_path + " is for a filter of another geometry");
+    if (verify && Digest() != p.base_digest)
+      throw std::runtime_error("patch " + patch_path + " is not for this generation of the filter");
+
+    const SeedTable<>::Overflow *table_overflow = reinterpret_cast<const SeedTable<>::Overflow *>(patch.data() + sizeof(PatchHeader));
+    const SeedTable<>::Overflow *seed_overflow = table_overflow + p.table_overflow;
+    const uint8_t *runs = reinterpret_cast<const uint8_t *>(seed_overflow + p.seed_overflow);
+    const uint8_t *runs_end = runs + p.run_bytes;
+
+    // decode and check every run before the first write, so a bad patch leaves the filter alone
+    struct Run
+    {
+      uint64_t offset, bytes;
+      const uint8_t *data;
+    };
+    std::vector<Run> todo;
+    todo.reserve(p.num_runs);
+    auto get = [&](uint64_t &v) {
+      v = 0;
+      for (int shift = 0; shift < 64; shift += 7)
+      {
+        if (runs == runs_end)
+          return false;
+        const uint8_t c = *runs++;
+        v |= uint64_t(c & 0x7f) << shift;
+        if (!(c & 0x80))
+          return true;
+      }
+      return false;
+    };
+    const uint64_t total = p.table_bytes + p.seed_bytes;
+    uint64_t end = 0;
+    for (uint64_t i = 0; i < p.num_runs; i++)
+    {
+      uint64_t gap, bytes;
+      if (!get(gap) || !get(bytes) || gap > total - end || bytes > total - end - gap ||
+          bytes > uint64_t(runs_end - runs) || (end + gap < p.table_bytes && end + gap + bytes > p.table_bytes))
+        throw std::runtime_error("filter patch corrupt: " + patch_path);
+      todo.push_back(Run{end + gap, bytes, runs});
+      runs += bytes;
+      end += gap + bytes;
+    }
+    if (runs != runs_end)
+      throw std::runtime_error("filter patch corrupt: " + patch_path);
+
+    if (file_)
+      file_->MakeWritable();
+    char *table = static_cast<char *>(table_->Data());
+    char *seeds = static_cast<char *>(seeds_.WordData());
+    auto at = [&](const Run &r) { return r.offset < p.table_bytes ? table + r.offset : seeds + (r.offset - p.table_bytes); };
+
+    // what the patch overwrites, put back when the result turns out not to be the target (a patch
+    // that decodes fine but was made for other contents), so no mix of two generations is left
+    std::vector<char> undo;
+    std::vector<SeedTable<>::Overflow> old_table_overflow, old_seed_overflow;
+    const size_t old_num_items = num_items_;
+    if (verify)
+    {
+      size_t undo_bytes = 0;
+      for (const Run &r : todo)
+        undo_bytes += r.bytes;
+      undo.reserve(undo_bytes);
+      for (const Run &r : todo)
+        undo.insert(undo.end(), at(r), at(r) + r.bytes);
+      size_t nt;
+      const SeedTable<>::Overflow *t = TableOverflow(nt, SeedsInTable());
+      old_table_overflow.assign(t, t + nt);
+      old_seed_overflow.assign(seeds_.OverflowData(), seeds_.OverflowData() + seeds_.NumOverflow());
+    }
+
+    for (const Run &r : todo)
+      memcpy(at(r), r.data, r.bytes);
+    SetTableOverflow(table_overflow, p.table_overflow, SeedsInTable());
+    seeds_.SetOverflow(seed_overflow, p.seed_overflow);
+    num_items_ = p.num_items;
+    if (verify && Digest() != p.target_digest)
+    {
+      const char *u = undo.data();
+      for (const Run &r : todo)
+      {
+        memcpy(at(r), u, r.bytes);
+        u += r.bytes;
+      }
+      SetTableOverflow(old_table_overflow.data(), old_table_overflow.size(), SeedsInTable());
+      seeds_.SetOverflow(old_seed_overflow.data(), old_seed_overflow.size());
+      num_items_ = old_num_items;
+      throw std::runtime_error("filter does not match the target of patch " + patch_path + " after applying it, left as it was");
+    }
+  }
+
+  template <typename ItemType, size_t bits_per_item, typename HashFamily,
+            template <size_t> class TableType, typename SeedsType>
+  VacuumFilter<ItemType, bits_per_item, HashFamily, TableType, SeedsType>::VacuumFilter(
+      const FileHeader &h, const HashFamily &hasher, int pages)
+      : table_(new TableType<bits_per_item>(h.num_buckets, pages)), num_items_(h.num_items), max_2_power(0), alt_len(0),
+        packed(h.packed), victim_(), hasher_(hasher), big_seg(h.big_seg), nonzero_alt_(h.nonzero_alt)
+  {
+    victim_.used = false;
+    std::copy(h.len, h.len + AR, len);
+  }
+
+  template <typename ItemType, size_t bits_per_item, typename HashFamily,
+            template <size_t> class TableType, typename SeedsType>
+  void VacuumFilter<ItemType, bits_per_item, HashFamily, TableType, SeedsType>::EncodeBucket(
+      RangeEncoder &e, CompressModels &m, const size_t i, uint32_t &prev_seed) const
+  {
+    const uint32_t s = BucketSeed(i);
+    e.Encode(m.seed_nonzero[prev_seed != 0], s != 0);
+    if (s)
+    {
+      const uint32_t v = std::min<uint32_t>(s - 1, 15);
+      uint32_t node = 1;
+      for (int k = 3; k >= 0; k--)
+      {
+        const uint32_t bit = (v >> k) & 1;
+        e.Encode(m.seed_bits[node], bit);
+        node = node * 2 + bit;
+      }
+      if (v == 15)
+        e.EncodeDirect(s, 32);
+    }
+    prev_seed = s;
+
+    uint32_t tags[4];
+    table_->ReadBucket(i, tags);
+    for (size_t j = 0, empty = 0; j < 4; j++)
+    {
+      e.Encode(m.slot_used[j][empty], tags[j] != 0);
+      if (tags[j])
+        e.EncodeDirect(tags[j], bits_per_item);
+      empty = tags[j] == 0;
+    }
+  }
+
+  template <typename ItemType, size_t bits_per_item, typename HashFamily,
+            template <size_t> class TableType, typename SeedsType>
+  void VacuumFilter<ItemType, bits_per_item, HashFamily, TableType, SeedsType>::DecodeBucket(
+      RangeDecoder &d, CompressModels &m, const size_t i, uint32_t &prev_seed, SeedTable<SeedsType::kBitsPerSeed> &dense)
+  {
+    uint32_t s = 0;
+    if (d.Decode(m.seed_nonzero[prev_seed != 0]))
+    {
+      uint32_t node = 1;
+      for (int k = 0; k < 4; k++)
+        node = node * 2 + d.Decode(m.seed_bits[node]);
+      s = node - 16 + 1;
+      if (s == 16)
+        s = d.DecodeDirect(32);
+      StoreSeed(i, s, dense, SeedsInTable());
+    }
+    prev_seed = s;
+
+    uint32_t tags[4];
+    for (size_t j = 0, empty = 0; j < 4; j++)
+    {
+      tags[j] = d.Decode(m.slot_used[j][empty]) ? d.DecodeDirect(bits_per_item) : 0;
+      empty = tags[j] == 0;
+    }
+    table_->CopyBucket(i, tags);
+  }
+
+  template <typename ItemType, size_t bits_per_item, typename HashFamily,
+            template <size_t> class TableType, typename SeedsType>
+  void VacuumFilter<ItemType, bits_per_item, HashFamily, TableType, SeedsType>::SaveCompressed(const std::string &path) const
+  {
+    CompressedHeader c;
+    memset(&c, 0, sizeof(c));
+    memcpy(c.magic, kCompressedMagic, sizeof(kCompressedMagic));
+    c.version = kCompressedVersion;
+    c.byte_order = kByteOrderMark;
+    c.header_bytes = sizeof(CompressedHeader);
+    c.slots_per_bucket = 4;
+    c.filter = FilterHeader();
+    c.filter.sections[kSectionTable].bytes = table_->DataBytes();
+    c.filter.sections[kSectionTable].crc = Crc32c(table_->Data(), table_->DataBytes());
+    c.filter.sections[kSectionSeeds].bytes = seeds_.WordBytes();
+    c.filter.sections[kSectionSeeds].crc = Crc32c(seeds_.WordData(), seeds_.WordBytes());
+    size_t nt;
+    TableOverflow(nt, SeedsInTable());
+    c.raw_bytes = table_->DataBytes() + seeds_.WordBytes() + sizeof(SeedTable<>::Overflow) * (nt + seeds_.NumOverflow());
+
+    const std::string tmp = path + ".tmp";
+    FILE *f = fopen(tmp.c_str(), "wb");
+    if (!f)
+      throw std::runtime_error("could not create compressed filter " + tmp);
+    try
+    {
+      if (fwrite(&c, sizeof(c), 1, f) != 1 ||
+          (HashParamBytes<HashFamily>() && fwrite(&hasher_, HashParamBytes<HashFamily>(), 1, f) != 1))
+        throw std::runtime_error("could not write compressed filter " + tmp);
+      RangeEncoder e(f);
+      CompressModels m;
+      uint32_t prev_seed = 0;
+      for (size_t i = 0; i < table_->NumBuckets(); i++)
+        EncodeBucket(e, m, i, prev_seed);
+      c.stream_bytes = e.Finish();
+      // the stream size goes into the header last
+      if (fseeko(f, 0, SEEK_SET) != 0 || fwrite(&c, sizeof(c), 1, f) != 1 || fflush(f) != 0 || fsync(fileno(f)) != 0)
+        throw std::runtime_error("could not write compressed filter " + tmp);
+    }
+    catch (...)
+    {
+      fclose(f);
+      unlink(tmp.c_str());
+      throw;
+    }
+    if (fclose(f) != 0 || rename(tmp.c_str(), path.c_str()) != 0)
+    {
+      unlink(tmp.c_str());
+      throw std::runtime_error("could not write compressed filter " + path);
+    }
+  }
+
+  template <typename ItemType, size_t bits_per_item, typename HashFamily,
+            template <size_t> class TableType, typename SeedsType>
+  VacuumFilter<ItemType, bits_per_item, HashFamily, TableType, SeedsType> *
+  VacuumFilter<ItemType, bits_per_item, HashFamily, TableType, SeedsType>::LoadCompressed(const std::string &path, int pages)
+  {
+    FILE *in = fopen(path.c_str(), "rb");
+    if (!in)
+      throw std::runtime_error("could not open " + path);
+    try
+    {
+      VacuumFilter *f = LoadCompressed(in, pages);
+      fclose(in);
+      return f;
+    }
+    catch (...)
+    {
+      fclose(in);
+      throw;
+    }
+  }
+
+  template <typename ItemType, size_t bits_per_item, typename HashFamily,
+            template <size_t> class TableType, typename SeedsType>
+  VacuumFilter<ItemType, bits_per_item, HashFamily, TableType, SeedsType> *
+  VacuumFilter<ItemType, bits_per_item, HashFamily, TableType, SeedsType>::LoadCompressed(FILE *in, int pages)
+  {
+    CompressedHeader c;
+    if (fread(&c, sizeof(c), 1, in) != 1 || memcmp(c.magic, kCompressedMagic, sizeof(kCompressedMagic)) != 0)
+      throw std::runtime_error("not a compressed filter");
+    if (c.byte_order != kByteOrderMark)
+      throw std::runtime_error("compressed filter written with the other byte order");
+    if (c.version != kCompressedVersion || c.header_bytes != sizeof(CompressedHeader) || c.slots_per_bucket != 4)
+      throw std::runtime_error("compressed filter version " + std::to_string(c.version) + " not supported");
+    CheckFilterHeader(c.filter);
+    // bucket indexes of overflow seeds are 32-bit
+    if (c.filter.num_buckets > UINT32_MAX)
+      throw std::runtime_error("compressed filter truncated or corrupt");
+    HashFamily hasher;
+    if (HashParamBytes<HashFamily>() && fread(static_cast<void *>(&hasher), HashParamBytes<HashFamily>(), 1, in) != 1)
+      throw std::runtime_error("compressed filter truncated or corrupt");
+
+    std::unique_ptr<VacuumFilter> f(new VacuumFilter(c.filter, hasher, pages));
+    const size_t num_buckets = f->table_->NumBuckets();
+    SeedTable<SeedsType::kBitsPerSeed> dense(SeedsInTable::value ? 0 : num_buckets, pages);
+    RangeDecoder d(in, c.stream_bytes);
+    CompressModels m;
+    uint32_t prev_seed = 0;
+    for (size_t i = 0; i < num_buckets; i++)
+      f->DecodeBucket(d, m, i, prev_seed, dense);
+    if (!d.Done())
+      throw std::runtime_error("compressed filter truncated or corrupt");
+    if (!SeedsInTable::value)
+      f->AdoptSeeds(std::move(dense), pages, std::is_same<SeedsType, SeedTable<SeedsType::kBitsPerSeed>>());
+    // a stream that went wrong can still decode to some filter, the CRCs tell
+    const FileSectionEntry &t = c.filter.sections[kSectionTable], &s = c.filter.sections[kSectionSeeds];
+    if (t.bytes != f->table_->DataBytes() || t.crc != Crc32c(f->table_->Data(), t.bytes) ||
+        s.bytes != f->seeds_.WordBytes() || s.crc != Crc32c(f->seeds_.WordData(), s.bytes))
+      throw std::runtime_error("compressed filter checksum mismatch");
+    return f.release();
+  }
+
+  template <typename ItemType, size_t bits_per_item, typename HashFamily,
+            template <size_t> class TableType, typename SeedsType>
+  std::string VacuumFilter<ItemType, bits_per_item, HashFamily, TableType, SeedsType>::Info() const
   {
     std::stringstream ss;
     size_t table_size = table_->SizeInBytes();
     size_t seedtable_size = SeedTable_Size();
     size_t total_size = table_size + seedtable_size;
     ss << "VacuumFilter Status:\n"
-       << "\t\t" << table_->Info() << "\n"
-       << "\t\tKeys stored: " << Size() << "\n"
+       << "\t\t" << table_->Info() << "\n";
+    if (!SeedsInTable::value)
+      ss << "\t\t" << seeds_.Info();
+    ss << "\t\tKeys stored: " << Size() << "\n"
        << "\t\tLoad factor: " << LoadFactor() << "\n"
       //  << "\t\tHashtable size: " << (table_->SizeInBytes() >> 10) << " KB\n";
       << "\t\tHashtable size: " 
@@ -124,6 +124,9 @@ namespace vacuumhashtable
         bucket &operator[](size_type i) { return buckets_[i]; }
         const bucket &operator[](size_type i) const { return buckets_[i]; }
 
+        // pulls the fingerprints of bucket i into cache ahead of a probe
+        void prefetch_partials(size_type i) const { __builtin_prefetch(&buckets_[i].partials_); }
+
         void info() const
         {
             // std::cout << "BucketContainer status:\n"
@@ -151,7 +154,7 @@ namespace vacuumhashtable
             for (size_type j = 0; j < SLOT_PER_BUCKET; ++j)
             {
                 if (b.occupied(j))
-                    std::cout << b.partial(j);
+                    std::cout << +b.partial(j);
                 else
                     std::cout << " ";
 
@@ -187,7 +190,7 @@ namespace vacuumhashtable
                     if (b.occupied(j))
                     {
                         if (arg == "fp")
-                            std::cout << b.partial(j);
+                            std::cout << +b.partial(j);
                         else
                             std::cout << b.key(j);
                     }
@@ -0,0 +1,256 @@
+#ifndef COMPACT_BUCKET_CONTAINER_H
+#define COMPACT_BUCKET_CONTAINER_H
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace vacuumhashtable
+{
+    /**
+     * structure-of-arrays alternative to bucket_container, with the same interface
+     * fingerprints of all buckets live in one dense array (SLOT_PER_BUCKET partials per bucket, so
+     * 8 bytes per bucket for 12-bit fingerprints), occupancy is a bit mask per bucket and full keys
+     * sit in a parallel array that is only read for exact matches, insertion and rehashing.
+     * fingerprint-only probes then touch a single small word per bucket
+     *
+     * @tparam Key - type of keys in the table
+     * @tparam Allocator - type of key allocator
+     * @tparam Partial - type of fingerprint/partial keys
+     * @tparam SLOT_PER_BUCKET - number of slots for each bucket in the table
+     */
+
+    template <class Key, class Allocator, class Partial, std::size_t SLOT_PER_BUCKET>
+    class compact_bucket_container
+    {
+        static_assert(SLOT_PER_BUCKET <= 8, "compact_bucket_container keeps occupancy in an 8-bit mask");
+
+    public:
+        using key_type = Key;
+
+    private:
+        using traits_ = typename std::allocator_traits<Allocator>::template rebind_traits<key_type>;
+        using storage_key_type = typename std::aligned_storage<sizeof(key_type), alignof(key_type)>::type;
+
+    public:
+        using allocator_type = typename traits_::allocator_type;
+        using partial_t = Partial;
+        using size_type = typename traits_::size_type;
+        using reference = key_type &;
+        using const_reference = const key_type &;
+        using pointer = typename traits_::pointer;
+        using const_pointer = typename traits_::const_pointer;
+
+        /**
+             * read-only view of one bucket, pointing into the key, fingerprint and occupancy arrays.
+             * returned by value from operator[], all writes go through the container (setK, setFP, eraseK)
+             */
+        class bucket
+        {
+        public:
+            const key_type &key(size_type ind) const
+            {
+                return *static_cast<const key_type *>(static_cast<const void *>(&keys_[ind]));
+            }
+
+            partial_t partial(size_type ind) const { return partials_[ind]; }
+
+            bool occupied(size_type ind) const { return (*occupied_ >> ind) & 1; }
+
+        private:
+            friend class compact_bucket_container;
+
+            bucket(const storage_key_type *keys, const partial_t *partials, const uint8_t *occupied) noexcept
+                : keys_(keys), partials_(partials), occupied_(occupied) {}
+
+            const storage_key_type *keys_;
+            const partial_t *partials_;
+            const uint8_t *occupied_;
+        };
+
+        compact_bucket_container(size_type hp, const allocator_type &allocator) : allocator_(allocator), key_allocator_(allocator),
+                                                                                  hashpower_(hp), keys_(key_allocator_.allocate(size() * SLOT_PER_BUCKET)),
+                                                                                  partials_(size() * SLOT_PER_BUCKET), occupied_(size()) {}
+
+        ~compact_bucket_container() noexcept { destroy_buckets(); }
+
+        size_type hashpower() const
+        {
+            return hashpower_.load(std::memory_order_acquire);
+        }
+
+        void hashpower(size_type val)
+        {
+            hashpower_.store(val, std::memory_order_release);
+        }
+
+        size_type size() const { return hashpower(); }
+
+        allocator_type get_allocator() const { return allocator_; }
+
+        bucket operator[](size_type i) const
+        {
+            return bucket(&keys_[i * SLOT_PER_BUCKET], &partials_[i * SLOT_PER_BUCKET], &occupied_[i]);
+        }
+
+        // pulls the fingerprints of bucket i into cache ahead of a probe
+        void prefetch_partials(size_type i) const { __builtin_prefetch(&partials_[i * SLOT_PER_BUCKET]); }
+
+        void info() const
+        {
+            if (size() < 100)
+                print(); // whole items
+            print("fp"); // fingerprints
+        }
+
+        void printBucket(const size_t i)
+        {
+            const bucket b = (*this)[i];
+            std::cout << "Bucket " << i << ": [ ";
+            for (size_type j = 0; j < SLOT_PER_BUCKET; ++j)
+            {
+                if (b.occupied(j))
+                    std::cout << b.key(j);
+                else
+                    std::cout << " ";
+
+                if (j < SLOT_PER_BUCKET - 1)
+                    std::cout << ", ";
+            }
+            std::cout << "]\tFP/partials: [ ";
+            for (size_type j = 0; j < SLOT_PER_BUCKET; ++j)
+            {
+                if (b.occupied(j))
+                    std::cout << +b.partial(j);
+                else
+                    std::cout << " ";
+
+                if (j < SLOT_PER_BUCKET - 1)
+                    std::cout << ", ";
+            }
+            std::cout << "]\t";
+        }
+
+        void print(std::string arg = "") const
+        {
+            int it = size() > 40 ? 10 : size();
+            if (arg == "fp")
+                std::cout << (it == 10 ? "fp's (first 10):\n" : "fingerprints:\n");
+            else
+                std::cout << (it == 10 ? "items (first 10):\n" : "items:\n");
+            for (size_type i = 0; i < static_cast<size_type>(it); ++i)
+            {
+                const bucket b = (*this)[i];
+                std::cout << i << ": [ ";
+                for (size_type j = 0; j < SLOT_PER_BUCKET; ++j)
+                {
+                    if (b.occupied(j))
+                    {
+                        if (arg == "fp")
+                            std::cout << +b.partial(j);
+                        else
+                            std::cout << b.key(j);
+                    }
+                    else
+                    {
+                        std::cout << " ";
+                    }
+                    if (j < SLOT_PER_BUCKET - 1)
+                        std::cout << ", ";
+                }
+                std::cout << "]\n";
+            }
+        }
+
+        // Constructs live data in a bucket
+        template <typename K>
+        void setK(size_type ind, size_type slot, partial_t p, K &&k)
+        {
+            assert(!(*this)[ind].occupied(slot));
+            partials_[ind * SLOT_PER_BUCKET + slot] = p;
+            traits_::construct(allocator_, storage_key(ind, slot), std::forward<K>(k));
+            // This must occur last, to enforce a strong exception guarantee
+            occupied_[ind] |= 1 << slot;
+        }
+
+        // Destroys live data in a bucket. The fingerprint is cleared too, partial_key() never
+        // returns 0, so an empty slot can not match a probe
+        void eraseK(size_type ind, size_type slot)
+        {
+            assert((*this)[ind].occupied(slot));
+            occupied_[ind] &= ~(1 << slot);
+            partials_[ind * SLOT_PER_BUCKET + slot] = 0;
+            traits_::destroy(allocator_, storage_key(ind, slot));
+        }
+
+        // Adds fingerprint/partial to a bucket
+        void setFP(size_type ind, size_type slot, partial_t p)
+        {
+            assert((*this)[ind].occupied(slot));
+            partials_[ind * SLOT_PER_BUCKET + slot] = p;
+        }
+
+        // Destroys all the live data in the buckets. Does not deallocate the bucket memory.
+        void clear() noexcept
+        {
+            for (size_type i = 0; i < size(); ++i)
+            {
+                for (size_type j = 0; j < SLOT_PER_BUCKET; ++j)
+                {
+                    if ((occupied_[i] >> j) & 1)
+                        eraseK(i, j);
+                }
+            }
+        }
+
+        // Destroys and deallocates all data in the buckets. After this operation,
+        // the bucket container will have no allocated data.
+        void clear_and_deallocate() noexcept
+        {
+            destroy_buckets();
+        }
+
+    private:
+        using key_storage_traits_ = typename traits_::template rebind_traits<storage_key_type>;
+        using key_storage_pointer = typename key_storage_traits_::pointer;
+
+        key_type *storage_key(size_type ind, size_type slot)
+        {
+            return static_cast<key_type *>(static_cast<void *>(&keys_[ind * SLOT_PER_BUCKET + slot]));
+        }
+
+        void destroy_buckets() noexcept
+        {
+            if (keys_ == nullptr)
+            {
+                return;
+            }
+            clear();
+            key_allocator_.deallocate(keys_, size() * SLOT_PER_BUCKET);
+            keys_ = nullptr;
+            std::vector<partial_t>().swap(partials_);
+            std::vector<uint8_t>().swap(occupied_);
+        }
+
+        // This allocator matches the value_type and constructs the keys in place
+        allocator_type allocator_;
+        // This allocator is used for allocating the raw key slots, copy-constructed from `allocator_`
+        typename traits_::template rebind_alloc<storage_key_type> key_allocator_;
+
+        std::atomic<size_type> hashpower_;
+        // full keys, SLOT_PER_BUCKET per bucket
+        key_storage_pointer keys_;
+        // fingerprints, SLOT_PER_BUCKET per bucket, parallel to keys_
+        std::vector<partial_t> partials_;
+        // occupancy, bit j set if slot j of the bucket holds a key
+        std::vector<uint8_t> occupied_;
+    };
+} // namespace vacuumhashtable
+
+#endif // COMPACT_BUCKET_CONTAINER_H
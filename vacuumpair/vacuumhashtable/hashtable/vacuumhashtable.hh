@@ -21,7 +21,9 @@
 #include <bits/stdc++.h>
 
 #include "bucketcontainer.hh"
+#include "compactbucketcontainer.hh"
 #include "../../vacuumfilter/hashutil.h"
+#include "../../vacuumfilter/seedtable.h"
 
 // copied from vacuumfilter
 #define ROUNDDOWN(a, b) ((a) - ((a) % (b)))
@@ -31,16 +33,20 @@ namespace vacuumhashtable
 {
 
     template <class Key, std::size_t bits_per_key, typename Hash = cuckoofilter::TwoIndependentMultiplyShift, class KeyEqual = std::equal_to<Key>,
-              class Allocator = std::allocator<Key>, std::size_t SLOT_PER_BUCKET = 4>
+              class Allocator = std::allocator<Key>, std::size_t SLOT_PER_BUCKET = 4,
+              template <class, class, class, std::size_t> class BucketContainer = bucket_container>
     class vacuum_hashtable
     {
 
     private:
-        // Type of the fingerprint/partial key. TODO: make it configurable
-        using partial_t = uint32_t;
-        // Type of the buckets container
-        using buckets_t = bucket_container<Key, Allocator, partial_t, SLOT_PER_BUCKET>;
+        // Type of the fingerprint/partial key, the smallest unsigned type holding bits_per_key bits
+        using partial_t = typename std::conditional<bits_per_key <= 8, uint8_t,
+                                                    typename std::conditional<bits_per_key <= 16, uint16_t, uint32_t>::type>::type;
+        // Type of the buckets container: bucket_container keeps each bucket's keys, fingerprints and
+        // occupancy together, compact_bucket_container keeps fingerprints in a separate dense array
+        using buckets_t = BucketContainer<Key, Allocator, partial_t, SLOT_PER_BUCKET>;
         size_t num_items_;
+        size_t failed_inserts_; // keys dropped because no free slot was found for them
 
     public:
         using key_type = typename buckets_t::key_type;
@@ -64,9 +70,9 @@ namespace vacuumhashtable
      * @param equal - equality function instance to use
      * @param alloc ? 
      */
-        vacuum_hashtable(size_type n = (1U << 16) * 4, const Hash &hf = Hash(), bool aligned = false,
-                         const KeyEqual &equal = KeyEqual(), const Allocator &alloc = Allocator()) : num_items_(0), hash_fn_(hf), eq_fn_(equal),
-                                                                                                     buckets_(reserve_calc(n, aligned), alloc), seeds_(bucket_count()), num_lookup_rds_(0) {}
+        vacuum_hashtable(size_type n = (1U << 16) * 4, const Hash &hf = Hash(), bool aligned = false, bool blocked = false,
+                         const KeyEqual &equal = KeyEqual(), const Allocator &alloc = Allocator()) : num_items_(0), failed_inserts_(0), hash_fn_(hf), eq_fn_(equal),
+                                                                                                     buckets_(reserve_calc(n, aligned, blocked), alloc), seeds_(bucket_count()), num_lookup_rds_(0) {}
 
         /**
      * Copy constructor
@@ -116,6 +122,12 @@ namespace vacuumhashtable
    */
         bool empty() const { return size() == 0; }
 
+        /**
+     * Returns the number of keys that were dropped on insert because the cuckoo
+     * path ran out of kicks; the table has to be rebuilt larger if this is not 0.
+     */
+        size_t failed_inserts() const { return failed_inserts_; }
+
         /**
      * Returns the number of elements in the table.
      *
@@ -181,7 +193,7 @@ namespace vacuumhashtable
             for (size_t i = 0; i < bucket_count(); i++)
             {
                 // printSeed(i);
-                seed_map[seeds_.at(i)]++;
+                seed_map[seeds_.get(i)]++;
             }
             ss << "rehashing seed map:\n(key : value) = # rehashes : # buckets\n";
             for (auto &k : seed_map)
@@ -198,15 +210,15 @@ namespace vacuumhashtable
 
         void printSeed(const size_t i) const
         {
-            // if (seeds_.at(i) > 5)
-            std::cout << i << ": [ " << seeds_.at(i) << " ]\n";
+            // if (seeds_.get(i) > 5)
+            std::cout << i << ": [ " << seeds_.get(i) << " ]\n";
         }
 
         void printAllBuckets()
         {
             for (size_t i = 0; i < bucket_count(); i++)
             {
-                if (seeds_.at(i))
+                if (seeds_.get(i))
                     printBucket(i);
             }
         }
@@ -215,7 +227,7 @@ namespace vacuumhashtable
         {
             for (size_t i = 0; i < bucket_count(); i++)
             {
-                if (seeds_.at(i))
+                if (seeds_.get(i))
                     printSeed(i);
             }
         }
@@ -223,7 +235,7 @@ namespace vacuumhashtable
         void printBucket(const size_t i)
         {
             buckets_.printBucket(i);
-            bucket &b = buckets_[i];
+            const bucket &b = buckets_[i];
             std::cout << "HV's : [";
             for (size_t j = 0; j < slot_per_bucket(); j++)
             {
@@ -236,7 +248,7 @@ namespace vacuumhashtable
                     std::cout << ", ";
                 // partial_t fp = partial_key(hv);
             }
-            std::cout << "]\tseed: " << seeds_.at(i) << "\n";
+            std::cout << "]\tseed: " << seeds_.get(i) << "\n";
         }
 
         // Table hash information
@@ -264,7 +276,7 @@ namespace vacuumhashtable
 
             // find position in table
             auto b = compute_buckets(key);
-            table_position pos = cuckoo_insert(b, key); // finds insert spot, does not actually insert
+            table_position pos = nonzero_alt_ ? blocked_insert(b, key) : cuckoo_insert(b, key); // finds insert spot, does not actually insert
             // std::cout << "HT inserting key " << key << ": " << pos.index << ", " << pos.slot << "\n";// status: " << pos.status << "\n";
 
             // add to bucket
@@ -274,11 +286,16 @@ namespace vacuumhashtable
                 num_items_++;
                 return std::make_pair(pos.index, pos.slot);
             }
+            else if (pos.status == failure_table_full)
+            {
+                failed_inserts_++;
+            }
             else
             {
                 std::cout << "status NOT ok: " << pos.status << "\n";
                 assert(pos.status == failure_key_duplicated);
             }
+            return std::make_pair(pos.index, pos.slot);
             // return std::make_pair(pos.index, pos.slot);
         }
 
@@ -299,8 +316,13 @@ namespace vacuumhashtable
             // find position in table
             auto b = compute_buckets(key);
 
-            // search in both buckets
-            const table_position pos = cuckoo_find(key, b.i1, b.i2);
+            // search in both buckets, and in the spill buckets once both are full
+            table_position pos = cuckoo_find(key, b.i1, b.i2);
+            if (pos.status != ok && spills(b))
+            {
+                const TwoBuckets s = spill_buckets(b, key);
+                pos = cuckoo_find(key, s.i1, s.i2);
+            }
             // return pos.status == ok;
             // return std::make_pair(pos.index, pos.slot);
             if (pos.status == ok)
@@ -331,54 +353,148 @@ namespace vacuumhashtable
         // lookup fingerprint in buckets: false positive = increment seed for following rehash
         template <typename K>                            // std::pair<int32_t, int32_t> for i1, i2; -1 if not found at a bucket
         std::pair<int32_t, int32_t> lookup(const K &key) // const
+        {
+            // NOTE: false pos. can happen to occur in BOTH buckets - have to check both before updating seeds
+            std::pair<int32_t, int32_t> indices = find_fp(key);
+            if (indices.first >= 0)
+                mark_fp_bucket(indices.first);
+            if (indices.second >= 0)
+                mark_fp_bucket(indices.second);
+            // blocked: matches in the spill buckets are marked too, but not returned
+            if (spills(compute_buckets(key)))
+            {
+                const probe_result res = probe(key);
+                if (res.spill.first >= 0)
+                    mark_fp_bucket(res.spill.first);
+                if (res.spill.second >= 0)
+                    mark_fp_bucket(res.spill.second);
+            }
+            return indices;
+        }
+
+        // lookup fingerprint in buckets without updating any seeds, so it is safe to call
+        // from several threads during a lookup round (see mark_fp_bucket)
+        template <typename K>
+        std::pair<int32_t, int32_t> find_fp(const K &key) const
         {
             // find position in table
             auto b = compute_buckets(key);
 
             // get fingerprint
-            uint64_t hv1 = hashed_key(key, seeds_.at(b.i1));
-            uint64_t hv2 = hashed_key(key, seeds_.at(b.i2));
+            uint64_t hv1 = hashed_key(key, seeds_.get(b.i1));
+            uint64_t hv2 = hashed_key(key, seeds_.get(b.i2));
             partial_t fp1 = partial_key(hv1);
             partial_t fp2 = partial_key(hv2);
 
             // search in both buckets
             const table_position pos1 = cuckoo_find_fp(fp1, b.i1);
             const table_position pos2 = cuckoo_find_fp(fp2, b.i2);
-            // return pos.status == ok;
             int32_t i1 = -1;
             int32_t i2 = -1;
 
-            // NOTE: false pos. can happen to occur in BOTH buckets - pos1 cannot return yet, have to check pos2 also
             if (pos1.status == ok)
-            {
-                uint8_t &seed = seeds_.at(pos1.index);
-                if (seed < num_lookup_rds_)
-                {
-                    seed++;
-                    // seeds_.at(pos1.index)++;
-                    // std::cout << "fp on key: " << key << " hv: " << hv1 << " fp: " << fp1 << " at pos " << pos1.index << ", " << pos1.slot << ", seed to " << seed << "\n";
-                }
-                // return pos1.index;
                 i1 = pos1.index;
+            if (pos2.status == ok)
+            {
+                assert(pos2.index == b.i2);
+                i2 = pos2.index;
             }
+            return std::make_pair(i1, i2);
+        }
 
-            // uint64_t hv2 = hashed_key(key, seeds_.at(b.i2));
-            // partial_t fp2 = partial_key(hv2);
-            // const table_position pos2 = cuckoo_find_fp(fp2, b.i2);
+        // result of probe(): bucket indices with a fingerprint match as in find_fp(), the same for
+        // the spill buckets of a key whose buckets are both full (blocked tables, else -1), and
+        // whether the key itself is stored in the table (always false when compiled with NDEBUG)
+        struct probe_result
+        {
+            std::pair<int32_t, int32_t> indices;
+            std::pair<int32_t, int32_t> spill;
+            bool definite;
+        };
 
-            if (pos2.status == ok)
+        // single probe for a lookup round: computes both buckets once and walks each of them once,
+        // matching the fingerprint and the full key together. The exact-match check only feeds
+        // debug counters, so it is compiled out with NDEBUG and then each bucket is only scanned
+        // for its fingerprint
+        template <typename K>
+        probe_result probe(const K &key) const
+        {
+            auto b = compute_buckets(key);
+
+            partial_t fp1 = partial_key(hashed_key(key, seeds_.get(b.i1)));
+            partial_t fp2 = partial_key(hashed_key(key, seeds_.get(b.i2)));
+
+            bool definite = false;
+            int slot1 = try_probe_bucket(buckets_[b.i1], fp1, key, definite);
+            int slot2 = try_probe_bucket(buckets_[b.i2], fp2, key, definite);
+
+            probe_result res{std::make_pair(slot1 != -1 ? static_cast<int32_t>(b.i1) : -1,
+                                            slot2 != -1 ? static_cast<int32_t>(b.i2) : -1),
+                             std::make_pair(-1, -1), definite};
+            probe_spill(key, b, res);
+            return res;
+        }
+
+        // batched probe() over n keys: each stage runs across a window of keys and prefetches
+        // the seeds, then the buckets, before they are read, so the cache misses of a window
+        // overlap instead of forming one dependent chain per key (see VacuumFilter::Contain_many)
+        template <typename K>
+        void probe_many(const K *keys, size_t n, probe_result *result) const
+        {
+            TwoBuckets b[BATCH_SIZE];
+            partial_t fp1[BATCH_SIZE];
+            partial_t fp2[BATCH_SIZE];
+
+            for (size_t i = 0; i < n; i += BATCH_SIZE)
             {
-                assert(pos2.index == b.i2);
-                uint8_t &seed = seeds_.at(pos2.index);
-                if (seed < num_lookup_rds_)
+                size_t up = std::min<size_t>(BATCH_SIZE, n - i);
+                for (size_t j = 0; j < up; j++)
                 {
-                    seed++;
-                    // std::cout << "fp on key: " << key << " hv: " << hv2 << " fp: " << fp2 << " at pos " << pos2.index << ", " << pos2.slot << ", seed to " << seed << "\n";
+                    b[j] = compute_buckets(keys[i + j]);
+                    seeds_.prefetch(b[j].i1);
+                    seeds_.prefetch(b[j].i2);
+                }
+                for (size_t j = 0; j < up; j++)
+                {
+                    fp1[j] = partial_key(hashed_key(keys[i + j], seeds_.get(b[j].i1)));
+                    fp2[j] = partial_key(hashed_key(keys[i + j], seeds_.get(b[j].i2)));
+                    buckets_.prefetch_partials(b[j].i1);
+                    buckets_.prefetch_partials(b[j].i2);
+                }
+                for (size_t j = 0; j < up; j++)
+                {
+                    bool definite = false;
+                    int slot1 = try_probe_bucket(buckets_[b[j].i1], fp1[j], keys[i + j], definite);
+                    int slot2 = try_probe_bucket(buckets_[b[j].i2], fp2[j], keys[i + j], definite);
+                    result[i + j] = probe_result{std::make_pair(slot1 != -1 ? static_cast<int32_t>(b[j].i1) : -1,
+                                                                slot2 != -1 ? static_cast<int32_t>(b[j].i2) : -1),
+                                                 std::make_pair(-1, -1), definite};
+                    probe_spill(keys[i + j], b[j], result[i + j]);
                 }
-                i2 = pos2.index;
             }
-            // return pos1.index; // TODO: INACCURATE TRACKING OF REHASH INDEX - not_found gives index 0 if false pos. is in alt. bucket ONLY
-            return std::make_pair(i1, i2);
+        }
+
+        // increments the seed of bucket i after a false positive, at most once per lookup round,
+        // so it gets picked up by the following rehash_buckets()
+        void mark_fp_bucket(const size_t i)
+        {
+            uint32_t seed = seeds_.get(i);
+            if (seed < num_lookup_rds_)
+                seeds_.set(i, seed + 1);
+        }
+
+        // whether either bucket of the key was rehashed after the current lookup round; only these
+        // keys can produce a new false positive in the following round
+        template <typename K>
+        bool in_rehashed_bucket(const K &key) const
+        {
+            auto b = compute_buckets(key);
+            if (seeds_.get(b.i1) == num_lookup_rds_ || seeds_.get(b.i2) == num_lookup_rds_)
+                return true;
+            if (!spills(b))
+                return false;
+            const TwoBuckets s = spill_buckets(b, key);
+            return seeds_.get(s.i1) == num_lookup_rds_ || seeds_.get(s.i2) == num_lookup_rds_;
         }
 
         // returns number of buckets rehashed during after a lookup round
@@ -388,16 +504,16 @@ namespace vacuumhashtable
             uint32_t last_index;
             for (uint32_t i = 0; i < seeds_.size(); i++)
             {
-                if (seeds_.at(i) == num_lookup_rds_) // incremented if false pos. during lookup for fp's
+                if (seeds_.get(i) == num_lookup_rds_) // incremented if false pos. during lookup for fp's
                 {
                     last_index = i;
                     b_count++;
-                    bucket &b = buckets_[i];
+                    const bucket &b = buckets_[i];
                     for (int j = 0; j < static_cast<int>(slot_per_bucket()); ++j)
                     {
                         // rehash fp's at bucket index i
                         const size_type key = b.key(j);
-                        size_type hv = hashed_key(key, seeds_.at(i));
+                        size_type hv = hashed_key(key, seeds_.get(i));
                         partial_t fp = partial_key(hv);
                         if (b.occupied(j)) {
                             fp_to_bucket(i, j, fp);
@@ -408,22 +524,22 @@ namespace vacuumhashtable
             }
 
             // if (b_count)
-            //     std::cout << "LAST REHASHED BUCKET: " << last_index << ", value: " << seeds_.at(last_index) << "\n";
+            //     std::cout << "LAST REHASHED BUCKET: " << last_index << ", value: " << seeds_.get(last_index) << "\n";
 
             return b_count;
         }
 
         int get_seed(const size_t i) const
         {
-            return seeds_.at(i);
+            return seeds_.get(i);
         }
 
-        std::vector<uint8_t> get_seeds() const
+        const cuckoofilter::SeedTable<> &get_seeds() const
         { // std::vector<int> &seeds
             return seeds_;
             // seeds.resize(seeds_.size());
             // for(int i = 0; i < seeds_.size(); i++) {
-            //     seeds[i] = seeds_.at(i);
+            //     seeds[i] = seeds_.get(i);
             // }
         }
 
@@ -442,6 +558,20 @@ namespace vacuumhashtable
             }
         }
 
+        // copies the fingerprints of the occupied slots of bucket i to the front of fps,
+        // returns how many were copied
+        size_t export_bucket(const size_t i, uint32_t *fps) const
+        {
+            size_t n = 0;
+            const bucket &b = buckets_[i];
+            for (int j = 0; j < static_cast<int>(slot_per_bucket()); j++)
+            {
+                if (b.occupied(j))
+                    fps[n++] = b.partial(j);
+            }
+            return n;
+        }
+
         // template <typename key_type>
         // std::vector<key_type> export_bucket(const size_t i) const {
         //     std::vector<key_type> fp_bucket;
@@ -511,6 +641,7 @@ namespace vacuumhashtable
             int t = key * 0x5bd1e995;
             int seg = len[key & (AR - 1)];
             t = t & seg;
+            t += nonzero_alt_ & (t == 0); // blocked: never map a key to a single bucket
             return index ^ t;
             // (libcuckoo) ensure fp i6s nonzero for the multiply. 0xc6a4a7935bd1e995 is the
             // hash constant from 64-bit MurmurHash2
@@ -549,6 +680,44 @@ namespace vacuumhashtable
             return TwoBuckets(i1, i2);
         }
 
+        bool bucket_full(const size_type i) const
+        {
+            const bucket &b = buckets_[i];
+            for (size_type j = 0; j < slot_per_bucket(); j++)
+                if (!b.occupied(j))
+                    return false;
+            return true;
+        }
+
+        // blocked: whether both buckets b of a key are full. Only then does the key go to its
+        // spill buckets, and only then does the filter look there
+        bool spills(const TwoBuckets &b) const
+        {
+            return nonzero_alt_ && bucket_full(b.i1) && bucket_full(b.i2);
+        }
+
+        // blocked: the buckets standing in for b, the buckets of key, in the key's spill block
+        TwoBuckets spill_buckets(const TwoBuckets &b, const size_type key) const
+        {
+            return TwoBuckets(cuckoofilter::SpillBucket(b.i1, key, bucket_count()),
+                              cuckoofilter::SpillBucket(b.i2, key, bucket_count()));
+        }
+
+        // blocked: fills res.spill for a key whose block is full, as probe() does res.indices
+        template <typename K>
+        void probe_spill(const K &key, const TwoBuckets &b, probe_result &res) const
+        {
+            if (!spills(b))
+                return;
+            const TwoBuckets s = spill_buckets(b, key);
+            bool definite = false;
+            int slot1 = try_probe_bucket(buckets_[s.i1], partial_key(hashed_key(key, seeds_.get(s.i1))), key, definite);
+            int slot2 = try_probe_bucket(buckets_[s.i2], partial_key(hashed_key(key, seeds_.get(s.i2))), key, definite);
+            res.spill = std::make_pair(slot1 != -1 ? static_cast<int32_t>(s.i1) : -1,
+                                       slot2 != -1 ? static_cast<int32_t>(s.i2) : -1);
+            res.definite |= definite;
+        }
+
         // Data storage types and functions
 
         // The type of the bucket
@@ -641,6 +810,29 @@ namespace vacuumhashtable
             return -1;
         }
 
+        // try_probe_bucket searches the bucket for the fingerprint p and returns its slot, or -1 if
+        // not found. Unless compiled with NDEBUG, the same pass also sets `definite` if the full
+        // key is stored in the bucket.
+        template <typename K>
+        int try_probe_bucket(const bucket &b, const partial_t &p, const K &key, bool &definite) const
+        {
+#ifdef NDEBUG
+            (void)key;
+            (void)definite;
+            return try_fp_in_bucket(b, p);
+#else
+            int slot = -1;
+            for (int i = 0; i < static_cast<int>(slot_per_bucket()); ++i)
+            {
+                if (slot == -1 && key_eq()(p, b.partial(i)))
+                    slot = i;
+                if (b.occupied(i) && key_eq()(b.key(i), key))
+                    definite = true;
+            }
+            return slot;
+#endif
+        }
+
         // Insertion types and function
 
         /**
@@ -718,7 +910,7 @@ namespace vacuumhashtable
             size_type keys[4];
             size_type tmp_keys[4];
 
-            bucket &b1 = buckets_[b.i1];
+            const bucket &b1 = buckets_[b.i1];
             // std::cout << "b1: " << b.i1 << "\n";
             int potential_slot = insert_key_to_bucket(curindex, curkey, false, oldkey, keys);
             if (potential_slot >= 0) // !try_find_insert_bucket(b1, res1, key)
@@ -726,7 +918,7 @@ namespace vacuumhashtable
                 return table_position{b.i1, static_cast<size_type>(potential_slot),
                                       ok};
             }
-            bucket &b2 = buckets_[b.i2];
+            const bucket &b2 = buckets_[b.i2];
             // std::cout << "b2: " << b.i2 << "\n";
             uint32_t altbucket = b.i2;
             potential_slot = insert_key_to_bucket(altbucket, curkey, false, oldkey, keys);
@@ -773,9 +965,8 @@ namespace vacuumhashtable
                 curkey = oldkey;
                 curindex = alt_index(curindex, curkey);
             }
-            // victim assignments...
-            return table_position{curindex, static_cast<size_type>(potential_slot),
-                                  ok};
+            // the key kicked out last (curkey) has nowhere to go
+            return table_position{curindex, 0, failure_table_full};
             // size_type insert_bucket = 0;
             // size_type insert_slot = 0;
             // vacuum_status st = run_cuckoo(b, insert_bucket, insert_slot);
@@ -791,11 +982,85 @@ namespace vacuumhashtable
             // return table_position{0, 0, failure_table_full};
         }
 
+        // blocked: puts key in a free slot of b.i1 or b.i2, or makes one by moving a key of either
+        // bucket to its other bucket in the block, and returns where. Buckets never lose a key
+        template <typename K>
+        table_position place_in(const TwoBuckets &b, K &key)
+        {
+            size_type oldkey;
+            size_type keys[SLOT_PER_BUCKET];
+            size_type tmp_keys[SLOT_PER_BUCKET];
+            for (size_type i : {b.i1, b.i2})
+            {
+                int slot = insert_key_to_bucket(i, key, false, oldkey, keys);
+                if (slot >= 0)
+                    return table_position{i, static_cast<size_type>(slot), ok};
+            }
+            for (size_type i : {b.i1, b.i2})
+            {
+                const bucket &bk = buckets_[i];
+                for (size_type j = 0; j < slot_per_bucket(); j++)
+                {
+                    size_type moved = bk.key(j);
+                    const size_type alt = alt_index(i, moved);
+                    int slot = insert_key_to_bucket(alt, moved, false, oldkey, tmp_keys);
+                    if (slot >= 0)
+                    {
+                        buckets_.eraseK(i, j);
+                        add_to_bucket(i, j, partial_key(hashed_key(key)), key);
+                        return table_position{i, j, ok};
+                    }
+                }
+            }
+            return table_position{b.i1, 0, failure_table_full};
+        }
+
+        // blocked_insert puts the key in one of its own buckets while they have room, else in its
+        // spill buckets in a second block. When those are full too, a key there that belongs to
+        // that block (not spilled from elsewhere) makes way and goes on to its own spill buckets,
+        // which it may as both of its buckets are full. Keys only leave a bucket when another
+        // takes their slot, so full buckets stay full and a lookup finds every spilled key
+        template <typename K>
+        table_position blocked_insert(TwoBuckets b, K &&key)
+        {
+            size_type cur = key;
+            const size_t kMaxSpillCount = 500;
+            for (size_t count = 0; count < kMaxSpillCount; count++)
+            {
+                table_position pos = place_in(b, cur);
+                if (pos.status == ok)
+                    return pos;
+                const TwoBuckets s = spill_buckets(b, cur);
+                pos = place_in(s, cur);
+                if (pos.status == ok)
+                    return pos;
+
+                // slots of the two spill buckets holding keys of the spill block itself
+                size_type from[2 * SLOT_PER_BUCKET];
+                int n = 0;
+                for (size_type i : {s.i1, s.i2})
+                    for (size_type j = 0; j < slot_per_bucket(); j++)
+                        if (index_hash(buckets_[i].key(j)) / BLOCK_BUCKETS == i / BLOCK_BUCKETS)
+                            from[n++] = i * SLOT_PER_BUCKET + j;
+                if (n == 0)
+                    break;
+
+                const size_type r = from[rand() % n], i = r / SLOT_PER_BUCKET, j = r % SLOT_PER_BUCKET;
+                const size_type next = buckets_[i].key(j);
+                buckets_.eraseK(i, j);
+                add_to_bucket(i, j, partial_key(hashed_key(cur)), cur);
+                cur = next;
+                b = TwoBuckets(i, alt_index(i, cur));
+            }
+            // the key handed on last (cur) has nowhere to go
+            return table_position{b.i1, 0, failure_table_full};
+        }
+
         // copying InsertTagToBucket from vacuum filter (singletable)
         template <typename K>
         int insert_key_to_bucket(const size_t i, K &&key, const bool kickout, size_type &oldkey, size_type *keys)
         {
-            bucket &b = buckets_[i];
+            const bucket &b = buckets_[i];
             const uint64_t hv = hashed_key(key);
             partial_t fp = partial_key(hv);
 
@@ -1010,8 +1275,8 @@ namespace vacuumhashtable
                 const size_type ts = to.slot;
                 TwoBuckets twob;
 
-                bucket &fb = buckets_[from.bucket];
-                bucket &tb = buckets_[to.bucket];
+                const bucket &fb = buckets_[from.bucket];
+                const bucket &tb = buckets_[to.bucket];
 
                 // std::cout << "from: " << from.bucket << ", " << from.slot << "\n";
                 // std::cout << "to: " << to.bucket << ", " << to.slot << "\n";
@@ -1125,14 +1390,32 @@ namespace vacuumhashtable
             return -1;
         }
 
+        // blocked_buckets returns the number of buckets for a blocked table of `items` keys at load
+        // factor lf. Keys whose two buckets are full go to a second block (blocked_insert), so the
+        // blocks need no room for the tail of the Poisson distributed number of keys hashed to each
+        // and fill about as far as an unblocked table
+        size_type blocked_buckets(const double items, const double lf) const
+        {
+            const int slots = BLOCK_BUCKETS * SLOT_PER_BUCKET;
+            return std::max<size_type>(1, std::ceil(items / (lf * slots))) * BLOCK_BUCKETS;
+        }
+
         // reserve_calc takes in a parameter specifying a certain number of slots
         // for a table and returns the smallest hashpower that will hold n elements.
         size_type
-        reserve_calc(const size_type n, bool aligned = false)
+        reserve_calc(const size_type n, bool aligned = false, bool blocked = false)
         {
             // Update for vacuum - follows filter code (n = max_num_keys, buckets = num_buckets)
             size_type buckets;
-            if (aligned)
+            nonzero_alt_ = blocked;
+            if (blocked)
+            {
+                buckets = blocked_buckets(n * 0.95, 0.9);
+                big_seg = BLOCK_BUCKETS - 1;
+                for (int i = 0; i < AR; i++)
+                    len[i] = BLOCK_BUCKETS - 1;
+            }
+            else if (aligned)
             {
                 buckets = cuckoofilter::upperpower2(std::max<uint64_t>(1, n / SLOT_PER_BUCKET));
                 if (buckets < 128)
@@ -1195,13 +1478,14 @@ namespace vacuumhashtable
         // necessary.
         mutable buckets_t buckets_;
 
-        std::vector<uint8_t> seeds_;
+        cuckoofilter::SeedTable<> seeds_;
         mutable size_t num_lookup_rds_; // max rehash count = lookup_rds - 1
         mutable size_t total_rehashes_;
 
         // vacuum
         int len[AR];
         int big_seg;
+        int nonzero_alt_; // 1 if alt_index never returns index itself (blocked tables)
     };
 
 }; // namespace cuckoohashtable
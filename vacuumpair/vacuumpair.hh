@@ -6,6 +6,7 @@
 #include <math.h>
 #include <bits/stdc++.h>
 #include "vacuumhashtable/city_hasher.hh"
+#include "keysource.hh"
 
 using namespace std;
 
@@ -13,48 +14,118 @@ using namespace std;
 idea: class for performing zeroing false positive algorithm, and returning cuckoo filter with seeds
 */
 
-template <typename KeyType, size_t bits_per_fp = 12, template <size_t> class TableType = cuckoofilter::SingleTable, class Hash = CityHasher<KeyType>>
+template <typename KeyType, size_t bits_per_fp = 12, template <size_t> class TableType = cuckoofilter::SingleTable, class Hash = CityHasher<KeyType>,
+          template <class, class, class, size_t> class BucketContainer = vacuumhashtable::bucket_container,
+          class SeedsType = cuckoofilter::SeedTable<>>
 class vacuumpair
 {
 private:
     size_t max_num_items_;
     size_t size_;
+    size_t num_threads_; // worker threads for each false positive lookup round
+    bool incremental_;   // re-query only keys of S mapped to rehashed buckets after the first round
+    bool blocked_;       // both buckets of a key in one block of BLOCK_BUCKETS buckets, at a lower load factor
+    int pages_;          // cuckoofilter::PageFlags for the filter's table and seeds
 
     // std::vector<uint8_t> seeds_;
 
+    // BucketContainer picks the hashtable layout, vacuumhashtable::compact_bucket_container keeps
+    // the fingerprints apart from the full keys
+    using table_t = vacuumhashtable::vacuum_hashtable<KeyType, bits_per_fp, Hash, std::equal_to<KeyType>,
+                                                      std::allocator<KeyType>, 4, BucketContainer>;
+    using probe_result = typename table_t::probe_result;
+
+public:
+    // one false positive lookup round of the last build
+    struct lookup_round
+    {
+        size_t queries;         // keys of S probed
+        size_t false_queries;   // false positives found, one per bucket that answered
+        double seconds;         // probing the keys and marking their buckets
+        size_t candidates;      // incremental mode: keys of S left for the next round, in rehashed buckets
+        double collect_seconds; // incremental mode: finding them
+    };
+
+private:
+    vector<lookup_round> rounds_;
+
 public:
-    vacuumhashtable::vacuum_hashtable<KeyType, bits_per_fp, Hash> *table_; // , CityHasher<KeyType>
-    cuckoofilter::VacuumFilter<size_t, bits_per_fp, Hash, TableType> *filter_;
+    // SeedsType = cuckoofilter::SparseSeedTable<> stores only the seeds of rehashed buckets in the filter
+    using filter_t = cuckoofilter::VacuumFilter<size_t, bits_per_fp, Hash, TableType, SeedsType>;
 
-    explicit vacuumpair(size_t max_num_items) : max_num_items_(max_num_items)
+    table_t *table_; // , CityHasher<KeyType>
+    filter_t *filter_;
+
+    // blocked is meant for TableType = cuckoofilter::SeededTable, where a block is one cache line
+    // pages e.g. cuckoofilter::kHugePages | cuckoofilter::kPopulatePages for filters of several GB
+    explicit vacuumpair(size_t max_num_items, size_t num_threads = 1, bool incremental = false, bool blocked = false,
+                        int pages = cuckoofilter::kNormalPages)
+        : max_num_items_(max_num_items), num_threads_(std::max<size_t>(1, num_threads)), incremental_(incremental), blocked_(blocked), pages_(pages), filter_(nullptr)
     {
         size_ = max_num_items_ / 0.95;
-        table_ = new vacuumhashtable::vacuum_hashtable<KeyType, bits_per_fp, Hash>(size_);
+        table_ = new table_t(size_, Hash(), false, blocked_);
+    }
+
+    ~vacuumpair()
+    {
+        delete table_;
+        delete filter_;
+    }
+
+    vacuumpair(const vacuumpair &) = delete;
+    vacuumpair &operator=(const vacuumpair &) = delete;
+
+    // hands the built filter over to the caller (e.g. to publish it with generation_manager), so the
+    // pair and its hashtable can be freed while the filter lives on
+    filter_t *release_filter()
+    {
+        filter_t *f = filter_;
+        filter_ = nullptr;
+        return f;
+    }
+
+    void init(const vector<KeyType> &r, const vector<KeyType> &s)
+    {
+        init(r.data(), r.size(), s.data(), s.size());
     }
 
-    // ~vacuumpair()
-    // {
-    //     delete table_;
-    //     delete filter_;
-    // }
+    // builds from non-owning views of R and S (e.g. mmap'd key files), neither set is copied
+    void init(const KeyType *r, size_t r_size, const KeyType *s, size_t s_size)
+    {
+        array_key_source<KeyType> source(s, s_size);
+        init(r, r_size, source);
+    }
 
-    void init(vector<KeyType> r, vector<KeyType> s)
+    void init(const vector<KeyType> &r, key_source<KeyType> &s)
     {
-        insert_hashtable(r);
-        // fn_lookup_hashtable(r);
+        init(r.data(), r.size(), s);
+    }
 
-        zero_fp_rehash(r, s);
+    // streaming build: S is read chunk by chunk from the source on every lookup round, so only the
+    // table, the seeds and one chunk of S have to fit in memory
+    void init(const KeyType *r, size_t r_size, key_source<KeyType> &s)
+    {
+        insert_hashtable(r, r_size);
+        while (table_->failed_inserts() > 0)
+        {
+            // some key of R found no slot, start over with 5% more room
+            cout << "Hashtable: " << table_->failed_inserts() << " keys did not fit, growing the table\n";
+            delete table_;
+            size_ = size_ * 1.05;
+            table_ = new table_t(size_, Hash(), false, blocked_);
+            insert_hashtable(r, r_size);
+        }
+        // fn_lookup_hashtable(r, r_size);
 
-        vector<vector<KeyType>> fp_table;
-        table_->export_table(fp_table);
+        zero_fp_rehash(s);
 
         cout << table_->seedInfo();
 
-        filter_ = new cuckoofilter::VacuumFilter<size_t, bits_per_fp, Hash, TableType>(size_, table_->get_seeds());
+        filter_ = new filter_t(size_, table_->get_seeds(), false, false, blocked_, pages_);
 
-        insert_filter(fp_table);
+        insert_filter();
 
-        check_lookup_filter(r, s);
+        check_lookup_filter(r, r_size, s);
 
         cout << filter_->Info() << "\ncomplete!\n";
     }
@@ -84,33 +155,43 @@ public:
         return filter_->LoadFactor();
     }
 
+    const vector<lookup_round> &lookup_rounds() const {
+        return rounds_;
+    }
+
 
 private:
     template <typename K>
-    void insert_hashtable(vector<K> &r)
+    void insert_hashtable(const K *r, size_t n)
     {
         // add set R to table
-        for (K c : r)
+        for (size_t i = 0; i < n; i++)
+        {
+            K c = r[i]; // insert() cuckoos through its key argument
             table_->insert(c);
+        }
         cout << "Hashtable: finish inserting " << table_->size() << " items\n";
     }
 
     template <typename K>
-    void fn_lookup_hashtable(vector<K> &r)
+    void fn_lookup_hashtable(const K *r, size_t n)
     {
         // check for false negatives with set R
-        for (KeyType c : r)
+        for (size_t i = 0; i < n; i++)
         {
+            KeyType c = r[i];
             std::pair<int32_t, int32_t> indices = table_->lookup(c);
             assert(indices.first >= 0 || indices.second >= 0);
             assert(table_->find(c).first >= 0); // first = index, second = slot
         }
     }
 
-    template <typename K>
-    void zero_fp_rehash(vector<K> &r, vector<K> &s)
+    void zero_fp_rehash(key_source<KeyType> &s)
     {
         int total_rehash = 0;
+        vector<KeyType> candidates; // incremental mode: keys of S mapped to a bucket rehashed in the last round
+        bool streaming = true;      // S is re-read from the source until the candidates take over
+        rounds_.clear();
 
         while (1)
         {
@@ -118,71 +199,206 @@ private:
             size_t false_queries = 0;
             size_t definite_queries = 0;
 
+            auto start = chrono::steady_clock::now();
             table_->start_lookup();
-            for (K l : s)
+            if (streaming)
             {
-                if (table_->find(l).first >= 0)
-                    definite_queries++;
-                total_queries++;
-
-                std::pair<int32_t, int32_t> indices = table_->lookup(l);
-                if (indices.first >= 0 || indices.second >= 0)
+                s.rewind();
+                const KeyType *chunk;
+                size_t n;
+                while ((n = s.next(chunk)) > 0)
                 {
-                    if (indices.first >= 0)
-                        false_queries++;
-                    if (indices.second >= 0)
-                        false_queries++;
+                    lookup_chunk(chunk, n, false_queries, definite_queries);
+                    total_queries += n;
                 }
-                // else
-                //     assert(indices.first == -1 && indices.second == -1); // ensures zero/both buckets didn't yield false positives
+            }
+            else
+            {
+                lookup_chunk(candidates.data(), candidates.size(), false_queries, definite_queries);
+                total_queries = candidates.size();
             }
             // assert(definite_queries == 0); // normal HT should only result in true negatives, no fp's
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            rounds_.push_back(lookup_round{total_queries, false_queries, seconds, 0, 0});
 
             double fp = (double)false_queries * 100.0 / total_queries;
             cout << "total false positives: " << false_queries << " out of " << total_queries
-                 << ", fp rate: " << fp << "%\n";
+                 << ", fp rate: " << fp << "%, " << seconds * 1000 << " ms\n";
 
             // fprintf(file, "%lu, %lu, %.6f\n", table.num_rehashes() + 1, false_queries, fp);
 
             if (false_queries)
+            {
                 total_rehash += table_->rehash_buckets();
+                if (incremental_)
+                {
+                    // buckets rehashed next round are a subset of this round's, so the candidates only shrink
+                    start = chrono::steady_clock::now();
+                    vector<KeyType> next;
+                    if (streaming)
+                    {
+                        s.rewind();
+                        const KeyType *chunk;
+                        size_t n;
+                        while ((n = s.next(chunk)) > 0)
+                            collect_candidates(chunk, n, next);
+                    }
+                    else
+                        collect_candidates(candidates.data(), candidates.size(), next);
+                    candidates.swap(next);
+                    streaming = false;
+                    rounds_.back().candidates = candidates.size();
+                    rounds_.back().collect_seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+                    cout << "re-querying " << candidates.size() << " keys in rehashed buckets, found in "
+                         << rounds_.back().collect_seconds * 1000 << " ms\n";
+                }
+            }
             else
                 break;
         }
         cout << table_->info();
     }
 
+    // probes one chunk of S for the current lookup round and marks buckets with false positives
+    template <typename K>
+    void lookup_chunk(const K *keys, size_t n, size_t &false_queries, size_t &definite_queries)
+    {
+        if (num_threads_ > 1)
+        {
+            false_queries += parallel_lookup_chunk(keys, n);
+            return;
+        }
+
+        probe_result res[BATCH_SIZE];
+        for (size_t i = 0; i < n; i += BATCH_SIZE)
+        {
+            size_t up = min<size_t>(BATCH_SIZE, n - i);
+            table_->probe_many(keys + i, up, res);
+            for (size_t j = 0; j < up; j++)
+            {
+                if (res[j].definite)
+                    definite_queries++;
+
+                for (const std::pair<int32_t, int32_t> &indices : {res[j].indices, res[j].spill})
+                {
+                    if (indices.first >= 0)
+                    {
+                        table_->mark_fp_bucket(indices.first);
+                        false_queries++;
+                    }
+                    if (indices.second >= 0)
+                    {
+                        table_->mark_fp_bucket(indices.second);
+                        false_queries++;
+                    }
+                }
+                // else
+                //     assert(indices.first == -1 && indices.second == -1); // ensures zero/both buckets didn't yield false positives
+            }
+        }
+    }
+
+    template <typename K>
+    void collect_candidates(const K *keys, size_t n, vector<K> &next)
+    {
+        for (size_t i = 0; i < n; i++)
+            if (table_->in_rehashed_bucket(keys[i]))
+                next.push_back(keys[i]);
+    }
+
+    // splits the keys across num_threads_ workers, which only read the seeds fixed at the start of the
+    // chunk and record buckets with false positives. The buckets are marked for rehashing after all
+    // workers join, so the resulting seeds are the same as with the serial scan
     template <typename K>
-    void insert_filter(vector<vector<K>> &fp_table)
+    size_t parallel_lookup_chunk(const K *keys, size_t n)
+    {
+        vector<vector<uint32_t>> fp_buckets(num_threads_);
+        vector<size_t> false_queries(num_threads_, 0);
+        vector<thread> workers;
+
+        size_t chunk = (n + num_threads_ - 1) / num_threads_;
+        for (size_t t = 0; t < num_threads_; t++)
+        {
+            size_t begin = min(n, t * chunk);
+            size_t end = min(n, begin + chunk);
+            workers.emplace_back([this, keys, &fp_buckets, &false_queries, t, begin, end]() {
+                probe_result res[BATCH_SIZE];
+                for (size_t i = begin; i < end; i += BATCH_SIZE)
+                {
+                    size_t up = min<size_t>(BATCH_SIZE, end - i);
+                    table_->probe_many(keys + i, up, res);
+                    for (size_t j = 0; j < up; j++)
+                    {
+                        for (const std::pair<int32_t, int32_t> &indices : {res[j].indices, res[j].spill})
+                        {
+                            if (indices.first >= 0)
+                            {
+                                fp_buckets[t].push_back(indices.first);
+                                false_queries[t]++;
+                            }
+                            if (indices.second >= 0)
+                            {
+                                fp_buckets[t].push_back(indices.second);
+                                false_queries[t]++;
+                            }
+                        }
+                    }
+                }
+            });
+        }
+
+        for (auto &w : workers)
+            w.join();
+
+        size_t total = 0;
+        for (size_t t = 0; t < num_threads_; t++)
+        {
+            for (uint32_t i : fp_buckets[t])
+                table_->mark_fp_bucket(i);
+            total += false_queries[t];
+        }
+        return total;
+    }
+
+    void insert_filter()
     {
-        for (int i = 0; i < fp_table.size(); i++)
+        // copy the final fingerprints straight from each hashtable bucket into the filter table
+        uint32_t fps[4];
+        for (size_t i = 0; i < table_->bucket_count(); i++)
         {
-            vector<KeyType> &b = fp_table.at(i);
-            // cout << "bucket size: " << b.size() << "\n";
+            size_t n = table_->export_bucket(i, fps);
+            // cout << "bucket size: " << n << "\n";
 
-            for (int j = 0; j < b.size(); j++)
-                assert(filter_->CopyInsert(b.at(j), i, j) == cuckoofilter::Ok);
+            cuckoofilter::Status st = filter_->CopyBucket(fps, i, n);
+            assert(st == cuckoofilter::Ok);
+            (void)st;
         }
 
         cout << "Filter: finish inserting " << table_->size() << " items\n";
     }
 
     template <typename K>
-    void check_lookup_filter(vector<K> &r, vector<K> &s)
+    void check_lookup_filter(const K *r, size_t r_size, key_source<KeyType> &s)
     {
         cout << "\nChecking VF false negatives...\n";
-        for (auto c : r)
-            assert(filter_->Contain(c) == cuckoofilter::Ok);
+        for (size_t i = 0; i < r_size; i++)
+            assert(filter_->Contain(r[i]) == cuckoofilter::Ok);
 
         size_t total_queries = 0;
         size_t false_queries = 0;
         // checking false positives (should be 0 after rehashes)
         cout << "Now checking VF false positives...\n";
-        for (auto l : s)
+        s.rewind();
+        const KeyType *chunk;
+        size_t n;
+        while ((n = s.next(chunk)) > 0)
         {
-            if (filter_->Contain(l) == cuckoofilter::Ok)
-                false_queries++;
-            total_queries++;
+            for (size_t i = 0; i < n; i++)
+            {
+                if (filter_->Contain(chunk[i]) == cuckoofilter::Ok)
+                    false_queries++;
+                total_queries++;
+            }
         }
         assert(false_queries == 0);
         // assert(total_queries == filter_->Size() * 100);
@@ -195,6 +411,32 @@ public:
         return filter_->Contain(key) == cuckoofilter::Ok;
     }
 
+    // lookup() of n keys at once, result[i] = lookup(keys[i])
+    void lookup_many(const KeyType *keys, size_t n, bool *result) const
+    {
+        for (size_t i = 0; i < n; i += 1 << 30) // Contain_many counts keys in an int
+            filter_->Contain_many(keys + i, result + i, std::min<size_t>(1 << 30, n - i));
+    }
+
+    // lookup() of n keys streamed through the filter, bit i of bitmap = lookup(keys[i]);
+    // bitmap must hold (n + 63) / 64 words
+    void lookup_stream(const KeyType *keys, size_t n, uint64_t *bitmap) const
+    {
+        filter_->Contain_stream(keys, keys + n, bitmap);
+    }
+
+    // writes the built filter to path, for a later filter_t::Map(path) to serve lookups without a rebuild
+    void save_filter(const std::string &path) const
+    {
+        filter_->Save(path);
+    }
+
+    // writes the built filter compressed for shipping, for filter_t::LoadCompressed(path) on the other end
+    void save_compressed(const std::string &path) const
+    {
+        filter_->SaveCompressed(path);
+    }
+
     cuckoofilter::VacuumFilter<size_t, bits_per_fp, Hash> get_filter()
     {
         return *filter_;
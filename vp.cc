@@ -2,6 +2,11 @@
 #include <cstdlib>
 
 #include "vacuumpair/vacuumpair.hh"
+#include "vacuumpair/queryservice.hh"
+#include "vacuumpair/generation.hh"
+#include "vacuumpair/certloader.hh"
+#include "vacuumpair/keyset.hh"
+#include <sys/wait.h>
 #include <time.h>
 
 #define memcle(a) memset(a, 0, sizeof(a))
@@ -24,38 +29,79 @@ void random_gen(int n, vector<uint64_t> &store, mt19937 &rd)
         store[i] = (uint64_t(rd()) << 32) + rd();
 }
 
+// runs f in a forked process and waits for it: files it writes come from another process, as
+// they do when each generation of a filter is built by its own run. rand(), which the cuckoo kicks
+// of the hashtable draw from, starts over as in a new process
+void run_in_child(const function<void()> &f)
+{
+    fflush(NULL);
+    pid_t pid = fork();
+    assert(pid >= 0);
+    if (pid == 0)
+    {
+        srand(1);
+        f();
+        fflush(NULL);
+        _exit(0);
+    }
+    int status = -1;
+    const bool waited = waitpid(pid, &status, 0) == pid;
+    assert(waited && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    (void)waited;
+}
+
+string read_file(const string &path)
+{
+    ifstream in(path, ios::binary);
+    return string((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+}
+
 template <typename KeyType>
 void read_cert(vector<KeyType> &r, vector<KeyType> &s)
 {
-    string line;
     string revoked_filename = "final_revoked_unique.txt";     // 28,341,276
     string unrevoked_filename = "final_unrevoked_unique.txt"; // 262,328
 
-    ifstream revoked(revoked_filename);     // 500 , final_revoked.txt 27496
-    ifstream unrevoked(unrevoked_filename); // 50000 , final_unrevoked.txt 29725064
-
-    auto start = chrono::steady_clock::now();
-    while (getline(revoked, line))
-    {                                                 // gets revoked line by line, saves in string
-        uint64_t i = stoul(line.c_str(), nullptr, 0); // convert string to long
-        r.push_back(i);
+    // key sets converted from the lists by the keyset tool are mapped instead when they are there
+    if (access("final_revoked_unique.keys", R_OK) == 0 && access("final_unrevoked_unique.keys", R_OK) == 0)
+    {
+        auto start = chrono::steady_clock::now();
+        keyset("final_revoked_unique.keys").read_all(r);
+        keyset("final_unrevoked_unique.keys").read_all(s);
+        auto end = chrono::steady_clock::now();
+        printf("time cost for read: %.3f s, revoked: %zu, unrevoked: %zu (key sets)\n", time_cost(start, end), r.size(), s.size());
+        return;
     }
-    revoked.close();
 
-    while (getline(unrevoked, line))
-    { // gets unrevoked line by line
-        uint64_t l = stoul(line.c_str(), nullptr, 0);
-        s.push_back(l);
-    }
-    unrevoked.close();
-    auto end = chrono::steady_clock::now();
-    // double cost = time_cost(start, end);
-    // cout << "time cost for read: " << cost << "\trevoked: " << r.size() << "\tunrevoked: " << s.size() << "\n";
+    // mapped and parsed by all cores (certloader.hh), several times faster than getline + stoul
+    cert_load_stats revoked = load_cert_file(revoked_filename, r);
+    cert_load_stats unrevoked = load_cert_file(unrevoked_filename, s);
+    double cost = revoked.seconds + unrevoked.seconds;
+    printf("time cost for read: %.3f s, revoked: %zu, unrevoked: %zu, %.1f MB/s, %.1f Mkeys/s, %zu threads\n", cost,
+           revoked.keys, unrevoked.keys, (revoked.bytes + unrevoked.bytes) / 1048576.0 / cost,
+           (revoked.keys + unrevoked.keys) / 1000000.0 / cost, revoked.threads);
+}
 
-    // fprintf(file, "revoked, unrevoked\n");
-    // fprintf(file, "%lu, %lu\n", r.size(), s.size());
+// pair of the lookup sweeps, its filter keeping the bucket seeds in SeedsType
+template <class SeedsType>
+using sweep_pair = vacuumpair<uint64_t, 12, cuckoofilter::SingleTable, CityHasher<uint64_t>, vacuumhashtable::bucket_container, SeedsType>;
+
+// seed bytes of the filter next to what SeedTable, which keeps every bucket's seed, would take for
+// the same seeds (the hashtable's), so a run with SeedsType = SparseSeedTable shows its saving
+template <class SeedsType>
+void seed_sizes(const sweep_pair<SeedsType> &vp, int &seed_bytes, int &dense_seed_bytes)
+{
+    seed_bytes = vp.seedtable_size();
+    dense_seed_bytes = vp.table_->get_seeds().SizeInBytes();
+}
+
+template <class SeedsType>
+const char *seeds_name()
+{
+    return std::is_same<SeedsType, cuckoofilter::SeedTable<>>::value ? "SeedTable" : "SparseSeedTable";
 }
 
+template <class SeedsType = cuckoofilter::SeedTable<>>
 void test_lf_lookup(int n = 0, int q = 0, int rept = 1)
 {
     FILE *out = fopen("vp_lf_lookup.csv", "a");
@@ -70,13 +116,15 @@ void test_lf_lookup(int n = 0, int q = 0, int rept = 1)
 
     mt19937 rd(seed);
     double mop[6][20], mop1[6][20], avg_rh[6][20];
-    int cnt[6][20], cnt1[6][20], max_rh[6][20];
+    int cnt[6][20], cnt1[6][20], max_rh[6][20], seed_bytes[6][20], dense_seed_bytes[6][20];
     memcle(mop);
     memcle(cnt);
     memcle(mop1);
     memcle(cnt1);
     memcle(max_rh);
     memcle(avg_rh);
+    memcle(seed_bytes);
+    memcle(dense_seed_bytes);
 
 
     int table_size = 0;
@@ -104,12 +152,13 @@ void test_lf_lookup(int n = 0, int q = 0, int rept = 1)
 
             // insertions take both insert and lookup sets as input
             // to generate more cascade levels upon finding false positive's
-            vacuumpair<uint64_t> vp(n);
+            sweep_pair<SeedsType> vp(n);
 
             vp.init(insKey, lupKey);
 
             max_rh[0][j] += vp.num_rehashes(); 
             avg_rh[0][j] += vp.avg_rehash(); 
+            seed_sizes(vp, seed_bytes[0][j], dense_seed_bytes[0][j]);
 
             table_size = vp.table_size();
             seedtable_size = vp.seedtable_size();
@@ -149,19 +198,22 @@ void test_lf_lookup(int n = 0, int q = 0, int rept = 1)
         }
     }
 
-    fprintf(out, "occupancy, vp neg, vp pos, max rehash, avg rehash, table mem = %d, seedtable mem = %d, total mem = %d, bits per item = %.2f, item numbers = %d, query number = %d\n", table_size, seedtable_size, table_size + seedtable_size, bits_per_item, n, q);
+    fprintf(out, "occupancy, vp neg, vp pos, max rehash, avg rehash, seed mem, SeedTable seed mem, seed bits per item, SeedTable seed bits per item, table mem = %d, seedtable mem = %d, total mem = %d, bits per item = %.2f, item numbers = %d, query number = %d, seeds = %s\n", table_size, seedtable_size, table_size + seedtable_size, bits_per_item, n, q, seeds_name<SeedsType>());
 
     for (int j = 0; j < 19; j++)
     {
+        const double items = int(n * (j + 1) * 0.05);
         fprintf(out, "%.2f, ", (j + 1) * 0.05);
         for (int k = 0; k < 1; k++)
-            fprintf(out, "%.5f, %.5f, %d, %.5f, ", mop[k][j] / cnt[k][j], mop1[k][j] / cnt1[k][j], max_rh[k][j], avg_rh[k][j]);
+            fprintf(out, "%.5f, %.5f, %d, %.5f, %d, %d, %.5f, %.5f, ", mop[k][j] / cnt[k][j], mop1[k][j] / cnt1[k][j], max_rh[k][j], avg_rh[k][j],
+                    seed_bytes[k][j], dense_seed_bytes[k][j], 8.0 * seed_bytes[k][j] / items, 8.0 * dense_seed_bytes[k][j] / items);
         fprintf(out, "\n");
     }
 
     fclose(out);
 }
 
+template <class SeedsType = cuckoofilter::SeedTable<>>
 void test_size_lookup(int n = 0, int q = 0, int rept = 1)
 {
     FILE *out = fopen("vp_size_lookup.csv", "a");
@@ -175,7 +227,7 @@ void test_size_lookup(int n = 0, int q = 0, int rept = 1)
 
     mt19937 rd(seed);
     double mop[6][20], mop1[6][20], bits_per_item[6][20], load_factor[6][20];
-    int cnt[6][20], cnt1[6][20], table_bytes[6][20], seed_bytes[6][20];
+    int cnt[6][20], cnt1[6][20], table_bytes[6][20], seed_bytes[6][20], dense_seed_bytes[6][20];
     memcle(mop);
     memcle(cnt);
     memcle(mop1);
@@ -183,6 +235,7 @@ void test_size_lookup(int n = 0, int q = 0, int rept = 1)
     memcle(bits_per_item);
     memcle(table_bytes);
     memcle(seed_bytes);
+    memcle(dense_seed_bytes);
 
     printf("vp size lookup\n");
     for (int t = 0; t < rept; t++)
@@ -205,14 +258,14 @@ void test_size_lookup(int n = 0, int q = 0, int rept = 1)
 
             // insertions take both insert and lookup sets as input
             // to generate more cascade levels upon finding false positive's
-            vacuumpair<uint64_t> vp(insKey.size());
+            sweep_pair<SeedsType> vp(insKey.size());
 
             vp.init(insKey, lupKey);
 
             bits_per_item[0][j] = vp.bits_per_item();
             load_factor[0][j] = vp.load_factor();
             table_bytes[0][j] = vp.table_size();
-            seed_bytes[0][j] = vp.seedtable_size();
+            seed_sizes(vp, seed_bytes[0][j], dense_seed_bytes[0][j]);
 
             auto start = chrono::steady_clock::now();
 
@@ -247,13 +300,15 @@ void test_size_lookup(int n = 0, int q = 0, int rept = 1)
         }
     }
 
-    fprintf(out, "num items, vp neg, vp pos, table size, seed size, total size, bits per item, load factor, item numbers = %d, query number = %d\n", n, q);
+    fprintf(out, "num items, vp neg, vp pos, table size, seed size, total size, bits per item, load factor, SeedTable seed size, seed bits per item, SeedTable seed bits per item, item numbers = %d, query number = %d, seeds = %s\n", n, q, seeds_name<SeedsType>());
 
     for (int j = 0; j < 19; j++)
     {
-        fprintf(out, "%d, ", int((j + 1) * 0.05 * n));
+        const int items = int((j + 1) * 0.05 * n);
+        fprintf(out, "%d, ", items);
         for (int k = 0; k < 1; k++)
-            fprintf(out, "%.5f, %.5f, %d, %d, %d, %.5f, %.5f, ", mop[k][j] / cnt[k][j], mop1[k][j] / cnt1[k][j], table_bytes[k][j], seed_bytes[k][j], table_bytes[k][j] + seed_bytes[k][j], bits_per_item[k][j], load_factor[k][j]);
+            fprintf(out, "%.5f, %.5f, %d, %d, %d, %.5f, %.5f, %d, %.5f, %.5f, ", mop[k][j] / cnt[k][j], mop1[k][j] / cnt1[k][j], table_bytes[k][j], seed_bytes[k][j], table_bytes[k][j] + seed_bytes[k][j], bits_per_item[k][j], load_factor[k][j],
+                    dense_seed_bytes[k][j], 8.0 * seed_bytes[k][j] / items, 8.0 * dense_seed_bytes[k][j] / items);
         fprintf(out, "\n");
     }
 
@@ -370,12 +425,752 @@ void test_cert_lookup(int n = 0, int q = 0, int rept = 1)
     fprintf(out, "\n");
 }
 
+// blocked vs unblocked seeded vacuum pair (seeds inside the buckets): batched lookup throughput
+// and the space the blocking costs, as load factor and bits per item
+void test_blocked_lookup(int n = 0, int q = 0, int rept = 1)
+{
+    FILE *out = fopen("vp_blocked_lookup.csv", "a");
+    assert(out != NULL);
+
+    if (n == 0)
+        n = (1 << 27);
+    if (q == 0)
+        q = 10000000;
+    int seed = 1;
+
+    mt19937 rd(seed);
+    double mop[2][20], mop1[2][20], bits_per_item[2][20], load_factor[2][20];
+    int cnt[2][20], cnt1[2][20], table_bytes[2][20];
+    memcle(mop);
+    memcle(cnt);
+    memcle(mop1);
+    memcle(cnt1);
+    memcle(bits_per_item);
+    memcle(load_factor);
+    memcle(table_bytes);
+
+    printf("vp blocked lookup\n");
+    for (int t = 0; t < rept; t++)
+    {
+        int j = 0;
+        for (double r = 0.05; r <= 0.48; r += 0.05, j++)
+        {
+            printf("r = %.2f\n", r);
+            int lim = int(n * r);
+            int p = min(q, lim) * 100;
+            vector<uint64_t> insKey, lupKey;
+            random_gen(lim, insKey, rd);
+            random_gen(p, lupKey, rd);
+            bool *res = new bool[max(p, lim)];
+
+            for (int k = 0; k < 2; k++) // 0: unblocked, 1: blocked
+            {
+                vacuumpair<uint64_t, 12, cuckoofilter::SeededTable> vp(insKey.size(), 1, false, k == 1);
+                vp.init(insKey, lupKey);
+
+                bits_per_item[k][j] = vp.bits_per_item();
+                load_factor[k][j] = vp.load_factor();
+                table_bytes[k][j] = vp.table_size();
+
+                auto start = chrono::steady_clock::now();
+                vp.lookup_many(lupKey.data(), p, res);
+                auto end = chrono::steady_clock::now();
+                double cost = time_cost(start, end);
+                mop[k][j] += double(p) / 1000000.0 / cost;
+                cnt[k][j] += 1;
+
+                int lookup_number = 0;
+                for (int i = 0; i < p; i++)
+                    lookup_number += !res[i];
+
+                int t = min(q, lim);
+                start = chrono::steady_clock::now();
+                vp.lookup_many(insKey.data(), t, res);
+                end = chrono::steady_clock::now();
+                cost = time_cost(start, end);
+                mop1[k][j] += double(t) / 1000000.0 / cost;
+                cnt1[k][j] += 1;
+
+                for (int i = 0; i < t; i++)
+                    lookup_number += res[i];
+                printf("%s: lookup_number = %d\n", k ? "blocked" : "unblocked", lookup_number);
+            }
+            delete[] res;
+        }
+    }
+
+    fprintf(out, "num items, vp neg, vp pos, table size, bits per item, load factor, blocked vp neg, blocked vp pos, blocked table size, blocked bits per item, blocked load factor, item numbers = %d, query number = %d\n", n, q);
+
+    for (int j = 0; j < 9; j++)
+    {
+        fprintf(out, "%d, ", int((j + 1) * 0.05 * n));
+        for (int k = 0; k < 2; k++)
+            fprintf(out, "%.5f, %.5f, %d, %.5f, %.5f, ", mop[k][j] / cnt[k][j], mop1[k][j] / cnt1[k][j], table_bytes[k][j], bits_per_item[k][j], load_factor[k][j]);
+        fprintf(out, "\n");
+    }
+
+    fclose(out);
+}
+
+// lookup throughput of one built filter through query_service from 1 to all cpus, with every thread
+// reading the same filter and with one replica of the filter per NUMA node
+void test_thread_scaling(int n = 0, int q = 0, int rept = 1)
+{
+    FILE *out = fopen("vp_thread_scaling.csv", "a");
+    assert(out != NULL);
+
+    if (n == 0)
+        n = 1000000;
+    if (q == 0)
+        q = 100000000;
+    int seed = 1;
+
+    mt19937 rd(seed);
+    vector<uint64_t> insKey, lupKey;
+    random_gen(n, insKey, rd);
+    random_gen(q, lupKey, rd);
+
+    typedef vacuumpair<uint64_t> vp_t;
+    vp_t vp(insKey.size());
+    vp.init(insKey, lupKey);
+
+    // queries: all of S and R, only R is in the filter once false positives are gone
+    vector<uint64_t> queries(lupKey);
+    queries.insert(queries.end(), insKey.begin(), insKey.end());
+    bool *res = new bool[queries.size()];
+
+    auto contain_many = [](const vp_t::filter_t &f, const uint64_t *keys, size_t m, bool *result) {
+        f.Contain_many(keys, result, m);
+    };
+
+    numa_topology topo = numa_topology::detect();
+    int cpus = topo.num_cpus();
+    printf("vp thread scaling: %d cpus on %zu NUMA nodes\n", cpus, topo.num_nodes());
+    fprintf(out, "threads, vp shared, vp replicated, nodes = %zu, item numbers = %d, query number = %zu\n", topo.num_nodes(), n, queries.size());
+
+    for (int t = 1;; t = min(t * 2, cpus))
+    {
+        double mop[2];
+        for (int replicate = 0; replicate < 2; replicate++)
+        {
+            query_service<vp_t::filter_t> service(*vp.filter_, contain_many, t, replicate);
+            mop[replicate] = 0;
+            for (int r = 0; r < rept; r++)
+            {
+                auto start = chrono::steady_clock::now();
+                service.lookup_many(queries.data(), queries.size(), res);
+                auto end = chrono::steady_clock::now();
+                mop[replicate] += double(queries.size()) / 1000000.0 / time_cost(start, end) / rept;
+            }
+            int lookup_number = count(res, res + queries.size(), true);
+            assert(lookup_number == n);
+            printf("threads = %d, replicas = %zu: %.5f Mops, lookup_number = %d\n", t, service.num_replicas(), mop[replicate], lookup_number);
+        }
+        fprintf(out, "%d, %.5f, %.5f\n", t, mop[0], mop[1]);
+        if (t == cpus)
+            break;
+    }
+
+    delete[] res;
+    fclose(out);
+}
+
+// lookups from reader threads while new filter generations are built and published through
+// generation_manager: throughput and latency of 4096-key lookup batches across the swaps
+void test_hot_swap(int n = 0, int q = 0, int gens = 3, int readers = 2)
+{
+    FILE *out = fopen("vp_hot_swap.csv", "a");
+    assert(out != NULL);
+
+    if (n == 0)
+        n = 1000000;
+    if (q == 0)
+        q = 10000000;
+    int seed = 1;
+    const int batch = 4096;
+
+    mt19937 rd(seed);
+    vector<uint64_t> lupKey; // S, the same for every generation, so no lookup may ever be positive
+    random_gen(q, lupKey, rd);
+
+    typedef vacuumpair<uint64_t> vp_t;
+    auto build = [&]() {
+        vector<uint64_t> insKey;
+        random_gen(n, insKey, rd);
+        vp_t vp(insKey.size());
+        vp.init(insKey, lupKey);
+        return vp.release_filter();
+    };
+
+    printf("vp hot swap\n");
+    generation_manager<vp_t::filter_t> gm(build());
+    atomic<bool> done(false);
+    vector<vector<double>> latency(readers);
+    vector<thread> threads;
+    for (int t = 0; t < readers; t++)
+        threads.push_back(thread([&, t]() {
+            generation_manager<vp_t::filter_t>::reader reader(gm);
+            bool res[batch];
+            size_t pos = size_t(t) * batch;
+            while (!done.load(memory_order_relaxed))
+            {
+                auto start = chrono::steady_clock::now();
+                {
+                    auto g = reader.read();
+                    g->Contain_many(&lupKey[pos], res, batch);
+                }
+                auto end = chrono::steady_clock::now();
+                latency[t].push_back(time_cost(start, end) * 1000000.0);
+                assert(count(res, res + batch, true) == 0);
+                pos = (pos + batch * readers) % (q - batch);
+            }
+        }));
+
+    auto start = chrono::steady_clock::now();
+    for (int g = 0; g < gens; g++)
+        printf("published generation %lu\n", gm.publish(build()));
+    done = true;
+    for (auto &t : threads)
+        t.join();
+    auto end = chrono::steady_clock::now();
+    size_t left = gm.reclaim();
+
+    vector<double> all;
+    for (auto &l : latency)
+        all.insert(all.end(), l.begin(), l.end());
+    sort(all.begin(), all.end());
+    double mops = double(all.size()) * batch / 1000000.0 / time_cost(start, end);
+    auto pct = [&](double p) { return all.empty() ? 0.0 : all[min(all.size() - 1, size_t(p * all.size()))]; };
+
+    printf("%.5f Mops, batch latency p50 %.1f us, p99 %.1f us, max %.1f us, %zu generations left to reclaim\n", mops, pct(0.5), pct(0.99), pct(1), left);
+    fprintf(out, "generations, readers, Mops, p50 us, p99 us, p999 us, max us, item numbers = %d, query number = %d\n", n, q);
+    fprintf(out, "%d, %d, %.5f, %.2f, %.2f, %.2f, %.2f\n", gens, readers, mops, pct(0.5), pct(0.99), pct(0.999), pct(1));
+    fclose(out);
+}
+
+// false positive lookup rounds run serially and on threads workers, from the same R and S: each
+// build in its own process, the saved filters (table and seeds) have to be the same bytes. Keys
+// probed and time of every round for both; the false positive counts can differ a little, as the
+// serial scan probes a bucket it already marked with the bucket's next seed
+void test_parallel_build(int n = 0, int q = 0, int threads = 0, const string &dir = ".")
+{
+    FILE *out = fopen("vp_parallel_build.csv", "a");
+    assert(out != NULL);
+
+    if (n == 0)
+        n = 1000000;
+    if (q == 0)
+        q = 100000000;
+    if (threads == 0)
+        threads = max(2u, thread::hardware_concurrency());
+    int seed = 1;
+
+    mt19937 rd(seed);
+    vector<uint64_t> insKey, lupKey;
+    random_gen(n, insKey, rd);
+    random_gen(q, lupKey, rd);
+
+    typedef vacuumpair<uint64_t> vp_t;
+    printf("vp parallel build: %d threads\n", threads);
+    fprintf(out, "threads, round, keys, false positives, s, Mkeys/s, item numbers = %d, query number = %d\n", n, q);
+    for (int t : {1, threads})
+        run_in_child([&]() {
+            auto start = chrono::steady_clock::now();
+            vp_t vp(insKey.size(), t);
+            vp.init(insKey, lupKey);
+            auto end = chrono::steady_clock::now();
+            vp.save_filter(dir + "/vp_parallel_" + to_string(t) + ".bin");
+
+            const auto &rounds = vp.lookup_rounds();
+            double scan = 0;
+            for (size_t i = 0; i < rounds.size(); i++)
+            {
+                printf("threads = %d, round %zu: %zu keys, %zu false positives, %.3f s (%.2f Mkeys/s)\n", t, i, rounds[i].queries,
+                       rounds[i].false_queries, rounds[i].seconds, rounds[i].queries / 1000000.0 / rounds[i].seconds);
+                fprintf(out, "%d, %zu, %zu, %zu, %.5f, %.5f\n", t, i, rounds[i].queries, rounds[i].false_queries, rounds[i].seconds,
+                        rounds[i].queries / 1000000.0 / rounds[i].seconds);
+                scan += rounds[i].seconds;
+            }
+            printf("threads = %d: build %.3f s, %.3f s of it in %zu lookup rounds\n", t, time_cost(start, end), scan, rounds.size());
+        });
+
+    const string serial = dir + "/vp_parallel_1.bin", parallel = dir + "/vp_parallel_" + to_string(threads) + ".bin";
+    assert(read_file(serial) == read_file(parallel));
+    unlink(serial.c_str());
+    unlink(parallel.c_str());
+    fclose(out);
+}
+
+// incremental build, which after the first round only re-queries the keys of S in rehashed
+// buckets, against full scans of S every round, from the same R and S: each build in its own
+// process, the saved filters have to be the same bytes. Keys probed, candidates left and time of
+// every round for both
+void test_incremental_build(int n = 0, int q = 0, const string &dir = ".")
+{
+    FILE *out = fopen("vp_incremental_build.csv", "a");
+    assert(out != NULL);
+
+    if (n == 0)
+        n = 1000000;
+    if (q == 0)
+        q = 100000000;
+    int seed = 1;
+
+    mt19937 rd(seed);
+    vector<uint64_t> insKey, lupKey;
+    random_gen(n, insKey, rd);
+    random_gen(q, lupKey, rd);
+
+    typedef vacuumpair<uint64_t> vp_t;
+    printf("vp incremental build\n");
+    fprintf(out, "incremental, round, keys, false positives, s, candidates, collect s, item numbers = %d, query number = %d\n", n, q);
+    for (bool incremental : {false, true})
+        run_in_child([&]() {
+            auto start = chrono::steady_clock::now();
+            vp_t vp(insKey.size(), 1, incremental);
+            vp.init(insKey, lupKey);
+            auto end = chrono::steady_clock::now();
+            vp.save_filter(dir + "/vp_incremental_" + to_string(incremental) + ".bin");
+
+            const auto &rounds = vp.lookup_rounds();
+            double scan = 0;
+            for (size_t i = 0; i < rounds.size(); i++)
+            {
+                printf("incremental = %d, round %zu: %zu keys, %zu false positives, %.3f s, %zu candidates found in %.3f s\n", incremental, i,
+                       rounds[i].queries, rounds[i].false_queries, rounds[i].seconds, rounds[i].candidates, rounds[i].collect_seconds);
+                fprintf(out, "%d, %zu, %zu, %zu, %.5f, %zu, %.5f\n", incremental, i, rounds[i].queries, rounds[i].false_queries,
+                        rounds[i].seconds, rounds[i].candidates, rounds[i].collect_seconds);
+                scan += rounds[i].seconds + rounds[i].collect_seconds;
+            }
+            printf("incremental = %d: build %.3f s, %.3f s of it in %zu lookup rounds\n", incremental, time_cost(start, end), scan, rounds.size());
+        });
+
+    const string full = dir + "/vp_incremental_0.bin", incremental = dir + "/vp_incremental_1.bin";
+    assert(read_file(full) == read_file(incremental));
+    unlink(full.c_str());
+    unlink(incremental.c_str());
+    fclose(out);
+}
+
+// hashtable bucket layouts from the same R and S: bucket_container, which keeps each bucket's keys
+// and fingerprints together, and compact_bucket_container, which keeps the fingerprints in a dense
+// array of their own. Each build in its own process, the saved filters have to be the same bytes.
+// Time of the build and of the probes of its lookup rounds for both; unless built with NDEBUG the
+// probes also compare full keys, which the compact layout keeps apart, so only the check counts then
+void test_bucket_layout(int n = 0, int q = 0, const string &dir = ".")
+{
+    FILE *out = fopen("vp_bucket_layout.csv", "a");
+    assert(out != NULL);
+
+    if (n == 0)
+        n = 1000000;
+    if (q == 0)
+        q = 100000000;
+    int seed = 1;
+
+    mt19937 rd(seed);
+    vector<uint64_t> insKey, lupKey;
+    random_gen(n, insKey, rd);
+    random_gen(q, lupKey, rd);
+
+    typedef vacuumpair<uint64_t> vp_t;
+    typedef vacuumpair<uint64_t, 12, cuckoofilter::SingleTable, CityHasher<uint64_t>, vacuumhashtable::compact_bucket_container> compact_vp_t;
+    auto build = [&](auto *vp, const char *layout) {
+        auto start = chrono::steady_clock::now();
+        vp->init(insKey, lupKey);
+        auto end = chrono::steady_clock::now();
+        vp->save_filter(dir + "/vp_layout_" + layout + ".bin");
+
+        size_t probed = 0;
+        double probe = 0;
+        for (const auto &round : vp->lookup_rounds())
+        {
+            probed += round.queries;
+            probe += round.seconds;
+        }
+        printf("%s: build %.3f s, %zu lookup rounds probing %zu keys in %.3f s (%.2f Mkeys/s)\n", layout, time_cost(start, end),
+               vp->lookup_rounds().size(), probed, probe, probed / 1000000.0 / probe);
+        fprintf(out, "%s, %.5f, %zu, %zu, %.5f, %.5f\n", layout, time_cost(start, end), vp->lookup_rounds().size(), probed, probe,
+                probed / 1000000.0 / probe);
+        delete vp;
+    };
+
+    printf("vp bucket layout\n");
+    fprintf(out, "layout, build s, rounds, keys probed, probe s, Mkeys/s, item numbers = %d, query number = %d\n", n, q);
+    run_in_child([&]() { build(new vp_t(insKey.size()), "bucket"); });
+    run_in_child([&]() { build(new compact_vp_t(insKey.size()), "compact"); });
+
+    const string bucket = dir + "/vp_layout_bucket.bin", compact = dir + "/vp_layout_compact.bin";
+    assert(read_file(bucket) == read_file(compact));
+    unlink(bucket.c_str());
+    unlink(compact.c_str());
+    fclose(out);
+}
+
+// build once, save the filter and map it back: time to build vs. time to open the saved filter
+// and run the first lookups from the mapping, which must answer exactly like the built filter.
+// Also the time to map it with its checksums verified, that a flipped bit is caught, and that a
+// build in two other processes saves the same bytes
+void test_save_map(int n = 0, int q = 0, const string &path = "vp_filter.bin")
+{
+    FILE *out = fopen("vp_save_map.csv", "a");
+    assert(out != NULL);
+
+    if (n == 0)
+        n = 1000000;
+    if (q == 0)
+        q = 10000000;
+    int seed = 1;
+
+    mt19937 rd(seed);
+    vector<uint64_t> insKey, lupKey;
+    random_gen(n, insKey, rd);
+    random_gen(q, lupKey, rd);
+
+    typedef vacuumpair<uint64_t> vp_t;
+    auto start = chrono::steady_clock::now();
+    vp_t vp(insKey.size());
+    vp.init(insKey, lupKey);
+    auto end = chrono::steady_clock::now();
+    double build = time_cost(start, end);
+
+    start = chrono::steady_clock::now();
+    vp.save_filter(path);
+    end = chrono::steady_clock::now();
+    double save = time_cost(start, end);
+
+    // the same filter built and saved by two processes is the same file, byte for byte
+    for (const char *suffix : {".2", ".3"})
+        run_in_child([&]() {
+            vp_t again(insKey.size());
+            again.init(insKey, lupKey);
+            again.save_filter(path + suffix);
+        });
+    assert(read_file(path + ".2") == read_file(path + ".3"));
+    unlink((path + ".2").c_str());
+    unlink((path + ".3").c_str());
+
+    start = chrono::steady_clock::now();
+    unique_ptr<vp_t::filter_t> mapped(vp_t::filter_t::Map(path, false, false));
+    end = chrono::steady_clock::now();
+    double open = time_cost(start, end);
+
+    start = chrono::steady_clock::now();
+    delete vp_t::filter_t::Map(path);
+    end = chrono::steady_clock::now();
+    double verified = time_cost(start, end);
+
+    {
+        // one bit of the table flipped in a copy of the file
+        ifstream in(path, ios::binary);
+        string bytes((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+        const cuckoofilter::FileHeader &h = *reinterpret_cast<const cuckoofilter::FileHeader *>(bytes.data());
+        bytes[h.sections[cuckoofilter::kSectionTable].offset + h.sections[cuckoofilter::kSectionTable].bytes / 2] ^= 4;
+        ofstream(path + ".bad", ios::binary) << bytes;
+        bool rejected = false;
+        try
+        {
+            delete vp_t::filter_t::Map(path + ".bad");
+        }
+        catch (const runtime_error &)
+        {
+            rejected = true;
+        }
+        assert(rejected);
+        unlink((path + ".bad").c_str());
+    }
+
+    // the first batch pays for the page faults of the mapping
+    const int batch = 4096;
+    bool *res = new bool[q];
+    bool *expect = new bool[q];
+    start = chrono::steady_clock::now();
+    mapped->Contain_many(lupKey.data(), res, batch);
+    end = chrono::steady_clock::now();
+    double first = time_cost(start, end);
+
+    start = chrono::steady_clock::now();
+    for (int i = batch; i < q; i += 1 << 20)
+        mapped->Contain_many(&lupKey[i], res + i, min(1 << 20, q - i));
+    end = chrono::steady_clock::now();
+    double rest = time_cost(start, end);
+
+    vp.lookup_many(lupKey.data(), q, expect);
+    assert(memcmp(res, expect, q) == 0);
+    for (auto k : insKey)
+        assert(mapped->Contain(k) == cuckoofilter::Ok);
+
+    struct stat st;
+    stat(path.c_str(), &st);
+    printf("build %.3f s, save %.3f s, map %.3f ms, verified map %.3f ms (%.2f GB/s), first %d lookups %.3f ms, %.5f Mops after, %.2f MB file\n",
+           build, save, open * 1000, verified * 1000, st.st_size / 1e9 / verified, batch, first * 1000,
+           (q - batch) / 1000000.0 / rest, st.st_size / 1048576.0);
+    fprintf(out, "build s, save s, map ms, verified map ms, first batch ms, Mops, file MB, item numbers = %d, query number = %d\n", n, q);
+    fprintf(out, "%.5f, %.5f, %.5f, %.5f, %.5f, %.5f, %.2f\n", build, save, open * 1000, verified * 1000, first * 1000,
+            (q - batch) / 1000000.0 / rest, st.st_size / 1048576.0);
+    delete[] res;
+    delete[] expect;
+    fclose(out);
+}
+
+// shipping a filter: size of the compressed file (SaveCompressed) against the one Save writes, at
+// load factor r, and the time to encode it and to decode it into a new filter on the other end.
+// The file has to come out the same from two processes building the same filter
+void test_compressed(int n = 0, double r = 0.95, const string &dir = ".")
+{
+    FILE *out = fopen("vp_compressed.csv", "a");
+    assert(out != NULL);
+
+    if (n == 0)
+        n = 1000000;
+    int seed = 1;
+    const string raw_path = dir + "/vp_filter.bin", path = dir + "/vp_filter.vfz";
+
+    mt19937 rd(seed);
+    vector<uint64_t> insKey, lupKey;
+    random_gen(int(n * r), insKey, rd);
+    random_gen(n * 10, lupKey, rd);
+
+    typedef vacuumpair<uint64_t> vp_t;
+    vp_t vp(n);
+    vp.init(insKey, lupKey);
+    vp.save_filter(raw_path);
+
+    auto start = chrono::steady_clock::now();
+    vp.save_compressed(path);
+    auto end = chrono::steady_clock::now();
+    double encode = time_cost(start, end);
+
+    // two processes building the same filter compress it to the same bytes
+    for (const char *suffix : {".2", ".3"})
+        run_in_child([&]() {
+            vp_t again(n);
+            again.init(insKey, lupKey);
+            again.save_compressed(path + suffix);
+        });
+    assert(read_file(path + ".2") == read_file(path + ".3"));
+    unlink((path + ".2").c_str());
+    unlink((path + ".3").c_str());
+
+    start = chrono::steady_clock::now();
+    unique_ptr<vp_t::filter_t> loaded(vp_t::filter_t::LoadCompressed(path));
+    end = chrono::steady_clock::now();
+    double decode = time_cost(start, end);
+
+    for (auto k : insKey)
+        assert(loaded->Contain(k) == cuckoofilter::Ok);
+    for (int i = 0; i < n; i++)
+        assert((loaded->Contain(lupKey[i]) == cuckoofilter::Ok) == vp.lookup(lupKey[i]));
+
+    struct stat raw, packed;
+    stat(raw_path.c_str(), &raw);
+    stat(path.c_str(), &packed);
+    printf("load factor %.3f, file %.2f MB, compressed %.2f MB (%.1f%%, %.2f bits per item), encode %.3f s, decode %.3f s (%.1f MB/s)\n",
+           vp.load_factor(), raw.st_size / 1048576.0, packed.st_size / 1048576.0, 100.0 * packed.st_size / raw.st_size,
+           8.0 * packed.st_size / insKey.size(), encode, decode, packed.st_size / 1048576.0 / decode);
+    fprintf(out, "load factor, file MB, compressed MB, ratio, bits per item, encode s, decode s, item numbers = %d, capacity = %d\n", int(insKey.size()), n);
+    fprintf(out, "%.5f, %.3f, %.3f, %.5f, %.3f, %.5f, %.5f\n", vp.load_factor(), raw.st_size / 1048576.0, packed.st_size / 1048576.0,
+            double(packed.st_size) / raw.st_size, 8.0 * packed.st_size / insKey.size(), encode, decode);
+    fclose(out);
+}
+
+// day-to-day update of a filter: generation A from n revoked keys, generation B after replacing a
+// churn fraction of them and adding as many new ones, both built with the same capacity so their
+// tables line up, each saved by its own process. Patch size and diff/apply time against the size
+// of the whole file; also a rebuild of A gives an empty patch and a patch with the wrong target is
+// undone
+void test_patch(int n = 0, double churn = 0.01, const string &dir = ".")
+{
+    FILE *out = fopen("vp_patch.csv", "a");
+    assert(out != NULL);
+
+    if (n == 0)
+        n = 1000000;
+    int seed = 1;
+    const int capacity = n * 1.1; // room for the keys added by the churn
+    const string a_path = dir + "/vp_gen_a.bin", b_path = dir + "/vp_gen_b.bin", patch_path = dir + "/vp_gen_ab.patch";
+
+    mt19937 rd(seed);
+    vector<uint64_t> insKey, lupKey, newKey;
+    random_gen(n, insKey, rd);
+    random_gen(n * 10, lupKey, rd);
+    vector<uint64_t> nextKey = insKey;
+    random_gen(int(n * churn) * 2, newKey, rd);
+    for (int i = 0; i < int(n * churn); i++)
+    {
+        nextKey[rd() % n] = newKey[2 * i];
+        nextKey.push_back(newKey[2 * i + 1]);
+    }
+
+    // each generation saved by its own process, as the daily builds are
+    typedef vacuumpair<uint64_t> vp_t;
+    run_in_child([&]() {
+        vp_t vp(capacity);
+        vp.init(insKey, lupKey);
+        vp.save_filter(a_path);
+    });
+    run_in_child([&]() {
+        vp_t vp(capacity);
+        vp.init(nextKey, lupKey);
+        vp.save_filter(b_path);
+    });
+
+    // A again from the same R and S, by the incremental build in yet another process: the same
+    // filter, so a patch without a single run
+    const string same_path = dir + "/vp_gen_a2.bin";
+    run_in_child([&]() {
+        vp_t vp(capacity, 1, true);
+        vp.init(insKey, lupKey);
+        vp.save_filter(same_path);
+    });
+    vp_t::filter_t::Diff(a_path, same_path, patch_path);
+    {
+        const string p = read_file(patch_path);
+        assert(p.size() >= sizeof(cuckoofilter::PatchHeader) &&
+               reinterpret_cast<const cuckoofilter::PatchHeader *>(p.data())->num_runs == 0);
+    }
+    unlink(same_path.c_str());
+
+    auto start = chrono::steady_clock::now();
+    size_t patch_bytes = vp_t::filter_t::Diff(a_path, b_path, patch_path);
+    auto end = chrono::steady_clock::now();
+    double diff = time_cost(start, end);
+
+    unique_ptr<vp_t::filter_t> f(vp_t::filter_t::Map(a_path));
+    start = chrono::steady_clock::now();
+    f->ApplyPatch(patch_path, false);
+    end = chrono::steady_clock::now();
+    double apply = time_cost(start, end);
+
+    unique_ptr<vp_t::filter_t> target(vp_t::filter_t::Map(b_path));
+    for (auto k : nextKey)
+        assert(f->Contain(k) == cuckoofilter::Ok);
+    for (auto k : lupKey)
+        assert(f->Contain(k) == target->Contain(k));
+
+    {
+        // a patch whose runs decode fine but whose target is not what they make: refused after
+        // applying it, and undone
+        string p = read_file(patch_path);
+        reinterpret_cast<cuckoofilter::PatchHeader *>(&p[0])->target_digest ^= 1;
+        ofstream(patch_path + ".bad", ios::binary) << p;
+        unique_ptr<vp_t::filter_t> g(vp_t::filter_t::Map(a_path)), base(vp_t::filter_t::Map(a_path));
+        bool rejected = false;
+        try
+        {
+            g->ApplyPatch(patch_path + ".bad");
+        }
+        catch (const runtime_error &)
+        {
+            rejected = true;
+        }
+        assert(rejected);
+        assert(g->Size() == base->Size());
+        for (auto k : insKey)
+            assert(g->Contain(k) == cuckoofilter::Ok);
+        for (auto k : lupKey)
+            assert(g->Contain(k) == base->Contain(k));
+        unlink((patch_path + ".bad").c_str());
+    }
+
+    struct stat st;
+    stat(b_path.c_str(), &st);
+    printf("churn %.4f: patch %zu of %ld bytes (%.2f%%), diff %.3f ms, apply %.3f ms\n", churn, patch_bytes, (long)st.st_size,
+           100.0 * patch_bytes / st.st_size, diff * 1000, apply * 1000);
+    fprintf(out, "churn, file bytes, patch bytes, patch %%, diff ms, apply ms, item numbers = %d\n", n);
+    fprintf(out, "%.5f, %ld, %zu, %.3f, %.5f, %.5f\n", churn, (long)st.st_size, patch_bytes, 100.0 * patch_bytes / st.st_size, diff * 1000, apply * 1000);
+    fclose(out);
+}
+
+// key sets (vacuumpair/keyset.hh) written and read back through read_all and keyset_source, empty
+// sets included, for every layout; a varint payload cut short has to be refused by both readers
+void test_keyset(const string &dir = ".")
+{
+    const string path = dir + "/vp_test.keys";
+    mt19937 rd(1);
+    for (int n : {0, 1, 100000})
+    {
+        vector<uint64_t> keys;
+        random_gen(n, keys, rd);
+        vector<uint64_t> sorted(keys);
+        sort(sorted.begin(), sorted.end());
+        for (unsigned flags : {0u, unsigned(keyset_sorted), unsigned(keyset_sorted | keyset_varint)})
+        {
+            write_keyset(path, keys.data(), keys.size(), flags, "test_keyset");
+            keyset ks(path);
+            const vector<uint64_t> &expect = flags ? sorted : keys;
+            vector<uint64_t> all, streamed;
+            ks.read_all(all);
+            keyset_source<uint64_t> src(ks, 4096);
+            const uint64_t *chunk;
+            for (size_t k; (k = src.next(chunk)) != 0;)
+                streamed.insert(streamed.end(), chunk, chunk + k);
+            assert(ks.size() == size_t(n) && all == expect && streamed == expect);
+        }
+    }
+
+    // the last bytes of a varint payload gone, the header still counting every key
+    vector<uint64_t> keys;
+    random_gen(1000, keys, rd);
+    write_keyset(path, keys.data(), keys.size(), keyset_varint, "test_keyset");
+    struct stat st;
+    stat(path.c_str(), &st);
+    assert(truncate(path.c_str(), st.st_size - 100) == 0);
+    {
+        FILE *f = fopen(path.c_str(), "r+b");
+        keyset_header h;
+        assert(f && fread(&h, sizeof(h), 1, f) == 1);
+        h.payload_bytes -= 100;
+        assert(fseek(f, 0, SEEK_SET) == 0 && fwrite(&h, sizeof(h), 1, f) == 1 && fclose(f) == 0);
+    }
+    keyset ks(path);
+    int rejected = 0;
+    try
+    {
+        vector<uint64_t> all;
+        ks.read_all(all);
+    }
+    catch (const runtime_error &)
+    {
+        rejected++;
+    }
+    try
+    {
+        keyset_source<uint64_t> src(ks, 256);
+        const uint64_t *chunk;
+        while (src.next(chunk) != 0)
+            ;
+    }
+    catch (const runtime_error &)
+    {
+        rejected++;
+    }
+    assert(rejected == 2);
+    unlink(path.c_str());
+    printf("key sets: round trips and truncated payload ok\n");
+}
+
 int main(int argc, char **argv)
 {
     int rept = 1;
     // test_lf_lookup(1000000, 100000000, rept);
     test_size_lookup(10000000, 1000000000, rept);
+    // sparse seeds (sparseseedtable.h): seed bits per item against SeedTable, and the lookup cost of the rank
+    // test_lf_lookup<cuckoofilter::SparseSeedTable<>>(1000000, 100000000, rept);
+    // test_size_lookup<cuckoofilter::SparseSeedTable<>>(10000000, 1000000000, rept);
     // test_cert_lookup(0, 0, rept);
+    // test_blocked_lookup(10000000, 10000000, rept);
+    // test_thread_scaling(1000000, 100000000, 3);
+    // test_hot_swap(1000000, 10000000, 3, 2);
+    // test_parallel_build(1000000, 100000000, 0);
+    // test_incremental_build(1000000, 100000000);
+    // test_bucket_layout(1000000, 100000000);
+    // test_save_map(1000000, 10000000);
+    // for (double churn : {0.0001, 0.001, 0.01})
+    //     test_patch(1000000, churn);
+    // for (double r : {0.5, 0.8, 0.95})
+    //     test_compressed(1000000, r);
+    // test_keyset();
 
     return 0;
 }
\ No newline at end of file